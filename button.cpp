@@ -1,75 +1,120 @@
 #include "button.hpp"
 
+#include <klib/math.hpp>
+
 namespace input {
-    buttons get_state(
-            const klib::time::us delta, const bool flipped, std::array<klib::time::us, 3>& timing, 
-            const std::array<bool, buttons::amount>& raw)
-    {
-        // timing parameters for button presses
-        constexpr static klib::time::us short_press = 20'000;
-        constexpr static klib::time::us long_press = 700'000;
-        
-        // return value
-        std::array<state, buttons::amount> ret = {};
-
-        // check if the buttons are still pressed
-        for (uint32_t i = 0; i < buttons::amount; i++) {
-            // check for a release of the button
-            if (!raw[i]) {
-                // no button press. Check if we had a button press before
-                if ((timing[i] >= short_press) && (timing[i] != pressed_marker)) {
-                    // we had a button press before. Set as pressed
-                    ret[i] = state::pressed;
-
-                    // set the timing with the pressed marker to mark
-                    // it as already pressed
-                    timing[i] = pressed_marker;
-                }
-                else if (timing[i] == pressed_marker) {
-                    // button is released as it was marked with the pressed
-                    // marker
-                    ret[i] = state::released;
+    bool is_pressed(const state button) {
+        return button == state::long_pressed || button == state::pressed;
+    }
 
-                    // clear the timing
-                    timing[i] = 0;
-                }
-                else {
-                    // no change
-                    ret[i] = state::no_change;
-                }
-            }
-            else {
-                // we have a button press. Add the delta time for 
-                // the button press
-                if (timing[i] < long_press) {
-                    timing[i] = timing[i] + delta;
-                }
+    namespace detail {
+        /**
+         * @brief Speed of the auto repeat after holding the button 
+         * for a while
+         * 
+         */
+        struct repeat_stage {
+            // time the button needs to be held for this stage
+            klib::time::us held;
 
-                // Check if we have passed the threshold for a long press
-                if ((timing[i] >= long_press) && (timing[i] != pressed_marker)) {
-                    ret[i] = state::long_pressed;
+            // time between the steps
+            klib::time::us interval;
 
-                    // set the timing with the pressed marker to mark
-                    // it as already pressed
-                    timing[i] = pressed_marker;
-                }
-                else {
-                    // user is still pressing set as no change
-                    ret[i] = state::no_change;
+            // amount to move every step
+            uint32_t step;
+        };
+
+        // stages of the auto repeat. The rate goes up first, after 
+        // that the step size goes up every second
+        constexpr static repeat_stage repeat_stages[] = {
+            {0, 150'000, 1},
+            {1'000'000, 75'000, 1},
+            {2'000'000, 40'000, 1},
+            {3'000'000, 40'000, 10},
+            {4'000'000, 40'000, 100},
+            {5'000'000, 40'000, 1000},
+        };
+
+        /**
+         * @brief Get the stage for the time the button is held
+         * 
+         * @param held 
+         * @return const repeat_stage& 
+         */
+        const repeat_stage& get_stage(const klib::time::us held) {
+            uint32_t index = 0;
+
+            for (uint32_t i = 1; i < (sizeof(repeat_stages) / sizeof(repeat_stages[0])); i++) {
+                if (held >= repeat_stages[i].held) {
+                    index = i;
                 }
             }
+
+            return repeat_stages[index];
         }
+    }
 
-        // if we are flipped swap the top and buttom buttons
-        if (flipped) {
-            return {ret[0], ret[1], ret[2]};
+    repeat::repeat(const uint32_t max_step): 
+        max_step(max_step), held(0), wait(0), active(false)
+    {}
+
+    uint32_t repeat::update(const state button, const klib::time::us delta) {
+        if (button == state::pressed) {
+            // short press. Move a single step
+            active = false;
+
+            return 1;
         }
-        else {
-            return {ret[2], ret[1], ret[0]};
+
+        if (button == state::released) {
+            active = false;
+
+            return 0;
         }
+
+        if (button == state::long_pressed) {
+            // start repeating. The first step is done directly
+            active = true;
+            held = 0;
+            wait = detail::get_stage(held).interval;
+
+            return 1;
+        }
+
+        if (!active) {
+            return 0;
+        }
+
+        // do all the steps that should have happened in the delta
+        klib::time::us remaining = delta;
+        uint32_t ret = 0;
+
+        while (remaining >= wait) {
+            remaining = remaining - wait;
+            held = held + wait;
+
+            const auto& stage = detail::get_stage(held);
+
+            ret += klib::min(stage.step, max_step);
+            wait = stage.interval;
+        }
+
+        // keep the time left until the next step
+        wait = wait - remaining;
+        held = held + remaining;
+
+        return ret;
     }
 
-    bool is_pressed(const state button) {
-        return button == state::long_pressed || button == state::pressed;
+    void repeat::stop() {
+        active = false;
+    }
+
+    bool repeat::is_active() const {
+        return active;
+    }
+
+    klib::time::us repeat::next_step() const {
+        return active ? wait : pressed_marker;
     }
-}
\ No newline at end of file
+}
@@ -37,22 +37,6 @@ namespace input {
         state down;
     };
 
-    /**
-     * @brief Get the button state using the raw input + old timing information
-     * 
-     * @param delta 
-     * @param flipped 
-     * @param timing 
-     * @param button0 
-     * @param button1 
-     * @param button2 
-     * @return menu::buttons 
-     */
-    buttons get_state(
-        const klib::time::us delta, const bool flipped, std::array<klib::time::us, 3>& timing, 
-        const std::array<bool, buttons::amount>& raw
-    );
-    
     /**
      * @brief Returns if a button is long or short pressed
      * 
@@ -60,4 +44,61 @@ namespace input {
      * @return false 
      */
     bool is_pressed(const state button);
+
+    /**
+     * @brief Auto repeat for a button. A short press is a single 
+     * step. After a long press the button keeps stepping until it
+     * is released. The rate and the step size grow the longer the
+     * button is held. The step size is limited to max_step
+     * 
+     */
+    class repeat {
+    protected:
+        // max amount a single step can move
+        uint32_t max_step;
+
+        // time the button is held since the long press
+        klib::time::us held;
+
+        // time until the next step
+        klib::time::us wait;
+
+        // flag if we are repeating
+        bool active;
+
+    public:
+        repeat(const uint32_t max_step = 1);
+
+        /**
+         * @brief Update the repeat with the state of the button. 
+         * Returns the amount to move (0 when nothing changed)
+         * 
+         * @param button 
+         * @param delta 
+         * @return uint32_t 
+         */
+        uint32_t update(const state button, const klib::time::us delta);
+
+        /**
+         * @brief Stop repeating
+         * 
+         */
+        void stop();
+
+        /**
+         * @brief Returns if the button is repeating
+         * 
+         * @return true 
+         * @return false 
+         */
+        bool is_active() const;
+
+        /**
+         * @brief Get the time until the next step. Returns the 
+         * pressed marker when we are not repeating
+         * 
+         * @return klib::time::us 
+         */
+        klib::time::us next_step() const;
+    };
 }
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <klib/klib.hpp>
+#include <klib/units.hpp>
+#include <klib/math.hpp>
+#include <klib/io/systick.hpp>
+
+#include "button.hpp"
+#include "spsc.hpp"
+
+namespace input {
+    /**
+     * @brief Change of a button detected by a edge interrupt
+     * 
+     */
+    struct event {
+        // time the edge happened
+        klib::time::us time;
+
+        // index of the button
+        uint8_t button;
+
+        // level of the button after the edge
+        bool pressed;
+    };
+
+    /**
+     * @brief Button input using the gpio edge interrupts. The
+     * interrupt only stores the edges with a timestamp. Debouncing
+     * and the short/long press detection are done on the
+     * timestamps, so the result does not depend on how often the
+     * main loop runs and the cpu can sleep while nothing happens
+     * 
+     * Only port 0 and port 2 have edge interrupts. These share
+     * the interrupt of EINT3
+     * 
+     * @tparam Pins 
+     */
+    template <typename... Pins>
+    class events {
+    protected:
+        static_assert(sizeof...(Pins) == buttons::amount, "Invalid amount of buttons");
+        static_assert(((Pins::port::id == 0 || Pins::port::id == 2) && ...), "Only port 0 and 2 support edge interrupts");
+
+        // interrupt of EINT3. Shared with the gpio interrupts
+        constexpr static uint32_t interrupt_id = 21 + 16;
+
+        // timing parameters for button presses. Same as the polled
+        // input
+        constexpr static klib::time::us short_press = 20'000;
+        constexpr static klib::time::us long_press = 700'000;
+
+        /**
+         * @brief State of a single button
+         * 
+         */
+        struct button_state {
+            // time the button was pressed
+            klib::time::us down;
+
+            // flag if the button is down
+            bool held;
+
+            // flag if we reported the press already (long press or
+            // pressed during startup)
+            bool reported;
+
+            // flag if we still need to report the release
+            bool release;
+        };
+
+        // edges from the interrupt
+        static inline spsc::queue<event, 32> queue;
+
+        // state of all the buttons
+        static inline std::array<button_state, buttons::amount> status = {};
+
+        /**
+         * @brief Add a event when the edge interrupt of a pin fired
+         * 
+         * @tparam Pin 
+         * @param index 
+         * @param port0 
+         * @param port2 
+         * @param time 
+         */
+        template <typename Pin>
+        static void check(const uint8_t index, const uint32_t port0, const uint32_t port2, const klib::time::us time) {
+            const uint32_t edges = (Pin::port::id == 0) ? port0 : port2;
+
+            if (!(edges & (0x1 << Pin::number))) {
+                return;
+            }
+
+            // store the level after the edge. If the queue is full
+            // the edge is lost. The next edge corrects the state
+            queue.push({time, index, Pin::get()});
+        }
+
+        /**
+         * @brief Interrupt handler for the gpio edges
+         * 
+         */
+        static void irq_handler() {
+            const auto time = klib::io::systick<>::template get_runtime<klib::time::us>();
+
+            // get and clear the rising and falling edges
+            const uint32_t port0 = GPIOINT->IO0IntStatR | GPIOINT->IO0IntStatF;
+            const uint32_t port2 = GPIOINT->IO2IntStatR | GPIOINT->IO2IntStatF;
+
+            GPIOINT->IO0IntClr = port0;
+            GPIOINT->IO2IntClr = port2;
+
+            // add a event for every button that changed
+            uint8_t index = 0;
+            (check<Pins>(index++, port0, port2, time), ...);
+        }
+
+        /**
+         * @brief Enable the rising and falling edge interrupt of a pin
+         * 
+         * @tparam Pin 
+         */
+        template <typename Pin>
+        static void enable() {
+            if constexpr (Pin::port::id == 0) {
+                GPIOINT->IO0IntEnR |= (0x1 << Pin::number);
+                GPIOINT->IO0IntEnF |= (0x1 << Pin::number);
+            }
+            else {
+                GPIOINT->IO2IntEnR |= (0x1 << Pin::number);
+                GPIOINT->IO2IntEnF |= (0x1 << Pin::number);
+            }
+        }
+
+    public:
+        /**
+         * @brief Init the edge interrupts. The pins should already
+         * be initialized. Buttons that are down are ignored until
+         * they are released
+         * 
+         */
+        static void init() {
+            // get the current state of the buttons. A button that
+            // is down is marked as reported so it does not trigger
+            // when it is released
+            uint8_t index = 0;
+            ((status[index++] = {{}, Pins::get(), Pins::get(), false}), ...);
+
+            // enable the edges of all the buttons
+            (enable<Pins>(), ...);
+
+            // register our interrupt handler and enable it
+            klib::target::irq::register_irq<interrupt_id>(irq_handler);
+            NVIC_EnableIRQ(static_cast<IRQn_Type>(interrupt_id - 16));
+        }
+
+        /**
+         * @brief Returns if we have edges that are not handled yet
+         * 
+         * @return true 
+         * @return false 
+         */
+        static bool pending() {
+            return !queue.empty();
+        }
+
+        /**
+         * @brief Returns if any button is down. Only uses the edges
+         * that are handled already
+         * 
+         * @return true 
+         * @return false 
+         */
+        static bool held() {
+            for (const auto& s: status) {
+                if (s.held) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /**
+         * @brief Get the time until a button that is down becomes a
+         * long press. Returns 0xffffffff when no button is waiting
+         * for a long press
+         * 
+         * @param now 
+         * @return klib::time::us 
+         */
+        static klib::time::us next_deadline(const klib::time::us now) {
+            klib::time::us ret = pressed_marker;
+
+            for (const auto& s: status) {
+                if (!s.held || s.reported) {
+                    continue;
+                }
+
+                const auto elapsed = now - s.down;
+
+                ret = klib::min(ret, (elapsed >= long_press) ? klib::time::us{} : (long_press - elapsed));
+            }
+
+            return ret;
+        }
+
+        /**
+         * @brief Get the button states using the edges we received.
+         * Reports at most one state per button per call. Edges
+         * after that are kept for the next call
+         * 
+         * @param now 
+         * @param flipped 
+         * @return buttons 
+         */
+        static buttons get_state(const klib::time::us now, const bool flipped) {
+            std::array<input::state, buttons::amount> ret = {
+                input::state::no_change, input::state::no_change, 
+                input::state::no_change
+            };
+
+            // report the release after a short press
+            for (uint32_t i = 0; i < buttons::amount; i++) {
+                if (status[i].release && !status[i].held) {
+                    status[i].release = false;
+                    ret[i] = input::state::released;
+                }
+            }
+
+            // handle the edges in the order they happened
+            while (!queue.empty()) {
+                const auto e = queue.front();
+                auto& s = status[e.button];
+
+                // keep the edge when we already have a state for
+                // the button
+                if (ret[e.button] != input::state::no_change) {
+                    break;
+                }
+
+                queue.pop();
+
+                // skip edges that do not change the state (two edges
+                // before the interrupt could read the level)
+                if (e.pressed == s.held) {
+                    continue;
+                }
+
+                s.held = e.pressed;
+
+                if (e.pressed) {
+                    // start timing the press
+                    s.down = e.time;
+                    s.reported = false;
+                    s.release = false;
+
+                    continue;
+                }
+
+                if (s.reported) {
+                    // the long press is already reported
+                    ret[e.button] = input::state::released;
+                }
+                else if ((e.time - s.down) >= short_press) {
+                    // short press. The release is reported on the
+                    // next call
+                    ret[e.button] = input::state::pressed;
+                    s.release = true;
+                }
+
+                // presses shorter than the short press are bounces
+            }
+
+            // check for long presses using the current time
+            for (uint32_t i = 0; i < buttons::amount; i++) {
+                auto& s = status[i];
+
+                if (ret[i] != input::state::no_change || !s.held || s.reported) {
+                    continue;
+                }
+
+                if ((now - s.down) >= long_press) {
+                    ret[i] = input::state::long_pressed;
+                    s.reported = true;
+                }
+            }
+
+            // if we are flipped swap the top and buttom buttons
+            if (flipped) {
+                return {ret[0], ret[1], ret[2]};
+            }
+            else {
+                return {ret[2], ret[1], ret[0]};
+            }
+        }
+    };
+}
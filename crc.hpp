@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace crc {
+    namespace detail {
+        // crc32 (reflected 0xedb88320 polynomial) table for a single
+        // nibble. Small enough to keep in flash without a big table
+        constexpr static std::array<uint32_t, 16> crc32_table = {
+            0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+            0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+            0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+            0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+        };
+    }
+
+    /**
+     * @brief Calculate the crc32 of a block of data. Can be
+     * chained by passing the result of a previous call
+     * 
+     * @param data 
+     * @param size 
+     * @param crc 
+     * @return uint32_t 
+     */
+    constexpr uint32_t crc32(const uint8_t* data, const uint32_t size, const uint32_t crc = 0) {
+        uint32_t ret = ~crc;
+
+        for (uint32_t i = 0; i < size; i++) {
+            // process the low and the high nibble of the byte
+            ret = detail::crc32_table[(ret ^ data[i]) & 0xf] ^ (ret >> 4);
+            ret = detail::crc32_table[(ret ^ (data[i] >> 4)) & 0xf] ^ (ret >> 4);
+        }
+
+        return ~ret;
+    }
+
+    namespace detail {
+        // check value of the crc32
+        constexpr static uint8_t crc32_check[] = {
+            '1', '2', '3', '4', '5', '6', '7', '8', '9'
+        };
+    }
+
+    static_assert(crc32(detail::crc32_check, sizeof(detail::crc32_check)) == 0xcbf43926, "Invalid crc");
+}
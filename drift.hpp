@@ -0,0 +1,681 @@
+#pragma once
+
+#include <cstdint>
+
+#include <klib/klib.hpp>
+#include <klib/units.hpp>
+#include <klib/io/systick.hpp>
+
+namespace drift {
+    // bit in the rtc general purpose register 4 that enables the
+    // automatic calibration. The register is cleared when the rtc
+    // loses power and is zero on devices from before the automatic
+    // calibration, so it is opt-in and never overwrites a 
+    // calibration the user set by hand. The bits below are used by
+    // the timezone and the current profile
+    constexpr static uint32_t automatic_bit = 13;
+
+    // max value of the rtc calibration register
+    constexpr static uint32_t max_calibration = 0x1ffff;
+
+    // scale of the drift values (parts per billion)
+    constexpr static int64_t ppb = 1'000'000'000;
+
+    /**
+     * @brief Returns if the calibration is updated automatically
+     * 
+     * @tparam RtcPeriph 
+     * @return true 
+     * @return false 
+     */
+    template <typename RtcPeriph>
+    bool is_automatic() {
+        return RtcPeriph::port->GPREG4 & (0x1 << automatic_bit);
+    }
+
+    /**
+     * @brief Enable or disable the automatic calibration
+     * 
+     * @tparam RtcPeriph 
+     * @param value 
+     */
+    template <typename RtcPeriph>
+    void set_automatic(const bool value) {
+        RtcPeriph::port->GPREG4 = (
+            (RtcPeriph::port->GPREG4 & ~(0x1 << automatic_bit)) |
+            (static_cast<uint32_t>(value) << automatic_bit)
+        );
+    }
+
+    /**
+     * @brief Get the correction of the current rtc calibration in
+     * parts per billion. Positive when the calibration adds time
+     * 
+     * @tparam RtcPeriph 
+     * @return int64_t 
+     */
+    template <typename RtcPeriph>
+    int64_t correction() {
+        // the calibration counter is disabled when the bit is set
+        if (RtcPeriph::port->CCR & (0x1 << 4)) {
+            return 0;
+        }
+
+        const uint32_t value = RtcPeriph::port->CALIBRATION & max_calibration;
+
+        // a value of 0 disables the calibration as well
+        if (!value) {
+            return 0;
+        }
+
+        // forward calibration skips a second every value seconds.
+        // Backward calibration stops the rtc for a second
+        const int64_t amount = ppb / value;
+
+        return (RtcPeriph::port->CALIBRATION & (0x1 << 17)) ? -amount : amount;
+    }
+
+    /**
+     * @brief Set the rtc calibration to cancel the drift of the
+     * rtc without calibration (in parts per billion). Positive
+     * when the rtc runs fast
+     * 
+     * @tparam RtcPeriph 
+     * @param drift 
+     */
+    template <typename RtcPeriph>
+    void apply(const int64_t drift) {
+        // get the correction we need
+        const int64_t needed = -drift;
+        const int64_t magnitude = (needed < 0) ? -needed : needed;
+
+        // the smallest correction is a second every max_calibration
+        // seconds. Disable the calibration when we need less than
+        // half of that
+        if (magnitude < ((ppb / max_calibration) / 2)) {
+            RtcPeriph::port->CCR |= (0x1 << 4);
+
+            return;
+        }
+
+        // get the amount of seconds between every correction
+        const uint32_t value = static_cast<uint32_t>(klib::max(static_cast<int64_t>(1), klib::min(
+            static_cast<int64_t>(max_calibration), (ppb + (magnitude / 2)) / magnitude
+        )));
+
+        // use the backward calibration when the rtc runs fast
+        RtcPeriph::port->CALIBRATION = value | (static_cast<uint32_t>(needed < 0) << 17);
+
+        // enable the calibration counter
+        RtcPeriph::port->CCR &= ~(0x1 << 4);
+    }
+
+    /**
+     * @brief Get the calibration settings of the rtc. Used to
+     * check if the calibration changed
+     * 
+     * @tparam RtcPeriph 
+     * @return uint32_t 
+     */
+    template <typename RtcPeriph>
+    uint32_t calibration_state() {
+        // calibration value, direction and the disable bit
+        return (RtcPeriph::port->CALIBRATION & 0x3ffff) | 
+            (((RtcPeriph::port->CCR >> 4) & 0x1) << 18);
+    }
+
+    /**
+     * @brief Fits the drift of the rtc using the time sets of the
+     * user. The difference between the rtc and the time the user
+     * sets is a sample of the drift since the previous time set. 
+     * The samples are combined into a least squares fit of the 
+     * drift rate. Longer intervals get more weight as the error
+     * of the user (about a second) is a smaller part of them
+     * 
+     * A sample that does not agree with the fit of the previous
+     * samples starts a new fit. The estimate is only used after
+     * a few samples agree
+     * 
+     * Everything is stored in the general purpose registers of the
+     * rtc so it survives a reset while the rtc has power:
+     * GPREG0: utc epoch of the last time set (0 when the next time
+     *         set should not be used as a sample)
+     * GPREG1: sum of the sample intervals in seconds
+     * GPREG2: sum of the sample offsets in milliseconds (signed)
+     * GPREG3: calibration settings at the last time set and the
+     *         amount of samples that agree in the upper 4 bits
+     * 
+     * @tparam RtcPeriph 
+     */
+    template <typename RtcPeriph>
+    class history {
+    protected:
+        // min time between two time sets to use it as a sample. 
+        // Shorter intervals are mostly the error of the user
+        constexpr static uint32_t min_interval = 24 * 60 * 60;
+
+        // max drift of a sample in parts per billion. Anything 
+        // more is not a correction of the drift (wrong date, rtc
+        // without power)
+        constexpr static int64_t max_drift = 100'000;
+
+        // max difference between the offset of a sample and the 
+        // offset the fit predicts in milliseconds
+        constexpr static int64_t max_error = 3'000;
+
+        // amount of samples that should agree before we use the 
+        // estimate
+        constexpr static uint32_t min_samples = 3;
+
+        // position of the sample count in GPREG3
+        constexpr static uint32_t count_shift = 28;
+        constexpr static uint32_t max_count = 0xf;
+
+        // max sum of the intervals. When we get more the old 
+        // samples are scaled down so the fit follows the aging
+        // and the temperature of the crystal
+        constexpr static uint32_t max_weight = 90 * 24 * 60 * 60;
+
+        /**
+         * @brief Get the amount of samples that agree
+         * 
+         * @return uint32_t 
+         */
+        static uint32_t count() {
+            return RtcPeriph::port->GPREG3 >> count_shift;
+        }
+
+        /**
+         * @brief Store the calibration settings and the amount of
+         * samples that agree
+         * 
+         * @param count 
+         */
+        static void store(const uint32_t count) {
+            RtcPeriph::port->GPREG3 = calibration_state<RtcPeriph>() | (count << count_shift);
+        }
+
+        /**
+         * @brief Add a sample to the fit. Returns false when the 
+         * sample is not used
+         * 
+         * @param previous 
+         * @param current 
+         * @return true 
+         * @return false 
+         */
+        static bool add(const uint32_t previous, const uint32_t current) {
+            const uint32_t last = RtcPeriph::port->GPREG0;
+
+            // we need a previous time set with the same calibration
+            if (!last || (current <= last) || 
+                ((RtcPeriph::port->GPREG3 & ((0x1 << count_shift) - 1)) != calibration_state<RtcPeriph>())) 
+            {
+                return false;
+            }
+
+            const uint32_t interval = current - last;
+
+            if (interval < min_interval) {
+                return false;
+            }
+
+            // difference between the rtc and the real time. Positive 
+            // when the rtc runs fast
+            const int64_t offset = (static_cast<int64_t>(previous) - current) * 1000;
+
+            // skip samples that are not a drift correction
+            const int64_t rate = (offset * (ppb / 1000)) / interval;
+
+            if ((rate > max_drift) || (rate < -max_drift)) {
+                return false;
+            }
+
+            // remove the correction of the calibration to get the
+            // offset of the rtc itself
+            const int64_t raw = offset - ((correction<RtcPeriph>() * interval) / (ppb / 1000));
+
+            uint32_t weight = RtcPeriph::port->GPREG1;
+            int64_t sum = static_cast<int32_t>(RtcPeriph::port->GPREG2);
+            uint32_t samples = count();
+
+            // check if the sample agrees with the previous samples
+            if (weight) {
+                const int64_t error = raw - ((sum * interval) / weight);
+
+                // start a new fit with only this sample when it does 
+                // not agree. Either the old samples or this sample 
+                // is wrong. The next samples tell which one
+                if ((error > max_error) || (error < -max_error)) {
+                    weight = 0;
+                    sum = 0;
+                    samples = 0;
+                }
+            }
+
+            // add the sample to the fit
+            weight += interval;
+            sum += raw;
+            samples = klib::min(samples + 1, max_count);
+
+            // scale down the old samples when we have enough
+            if (weight > max_weight) {
+                sum = (sum * max_weight) / weight;
+                weight = max_weight;
+            }
+
+            RtcPeriph::port->GPREG1 = weight;
+            RtcPeriph::port->GPREG2 = static_cast<uint32_t>(static_cast<int32_t>(sum));
+            store(samples);
+
+            return true;
+        }
+
+    public:
+        /**
+         * @brief Record a time set of the user. Updates the rtc 
+         * calibration when the automatic calibration is enabled
+         * and enough samples agree
+         * 
+         * @param previous utc epoch of the rtc before the time set 
+         * @param current utc epoch the user set 
+         */
+        static void record(const uint32_t previous, const uint32_t current) {
+            if (add(previous, current) && has_estimate() && is_automatic<RtcPeriph>()) {
+                apply<RtcPeriph>(estimate());
+            }
+
+            // start the next interval. Store the calibration after
+            // we changed it
+            RtcPeriph::port->GPREG0 = current;
+            store(count());
+        }
+
+        /**
+         * @brief Mark the rtc was set without a reference. The 
+         * interval up to the next time set is not a sample, the 
+         * time set after that is
+         * 
+         */
+        static void discard() {
+            RtcPeriph::port->GPREG0 = 0;
+        }
+
+        /**
+         * @brief Returns if enough samples agree to use the 
+         * estimate
+         * 
+         * @return true 
+         * @return false 
+         */
+        static bool has_estimate() {
+            return (RtcPeriph::port->GPREG1 != 0) && (count() >= min_samples);
+        }
+
+        /**
+         * @brief Get the drift of the rtc without calibration in 
+         * parts per billion. Positive when the rtc runs fast
+         * 
+         * @return int64_t 
+         */
+        static int64_t estimate() {
+            if (!RtcPeriph::port->GPREG1) {
+                return 0;
+            }
+
+            return (static_cast<int64_t>(static_cast<int32_t>(RtcPeriph::port->GPREG2)) * 
+                (ppb / 1000)) / RtcPeriph::port->GPREG1;
+        }
+    };
+
+    /**
+     * @brief Estimates the drift of the rtc using the usb start of
+     * frame of the host as reference. The host sends a frame every
+     * millisecond. Every rtc second is timestamped in the rtc
+     * interrupt, the main loop gets the frame number that belongs
+     * to it. After Window rtc seconds the amount of frames gives
+     * the drift of the rtc
+     * 
+     * The calibration steps of the rtc are found from the frames 
+     * and removed from the seconds, so the estimate is the drift
+     * without calibration. This also works when the window does 
+     * not have a step or when the calibration changes
+     * 
+     * Only the frames while the Usb device is configured are used.
+     * The window is restarted when the host stops sending frames
+     * (suspend, disconnect) or when the rtc is set
+     * 
+     * @tparam RtcPeriph 
+     * @tparam UsbPeriph 
+     * @tparam Usb 
+     * @tparam Window window in rtc seconds 
+     */
+    template <typename RtcPeriph, typename UsbPeriph, typename Usb, uint32_t Window = 600>
+    class estimator {
+    protected:
+        static_assert(Window >= 60, "Window is too short for a useful estimate");
+
+        // the frame number of the usb is 11 bits
+        constexpr static uint32_t frame_mask = 0x7ff;
+
+        // max difference between the frames and the systick between
+        // two seconds. Anything more means the host stopped sending
+        // frames
+        constexpr static int32_t max_jitter = 20;
+
+        // max time between two edges we handle. The rtc seconds
+        // wrap every minute
+        constexpr static uint32_t max_gap = 30'000'000;
+
+        // max amount of times we check the serial interface engine
+        // before we give up on a command. A command takes a few 
+        // microseconds
+        constexpr static uint32_t max_polls = 1000;
+
+        // time of the last rtc second and the amount of seconds we
+        // got. Written in the interrupt
+        static inline volatile uint32_t edge_time = 0;
+        static inline volatile uint32_t edges = 0;
+
+        // amount of edges we have handled
+        static inline uint32_t handled = 0;
+
+        // flag if we are measuring
+        static inline bool started = false;
+
+        // frame number, time and rtc second of the previous edge
+        static inline uint32_t last_frame = 0;
+        static inline uint32_t last_time = 0;
+        static inline uint32_t last_second = 0;
+
+        // amount of rtc seconds without the calibration steps and 
+        // the frames in the current window
+        static inline uint32_t seconds = 0;
+        static inline uint32_t frames = 0;
+
+        // last estimate of the drift without calibration in parts
+        // per billion. Positive when the rtc runs fast
+        static inline int64_t last_estimate = 0;
+        static inline bool valid = false;
+
+        /**
+         * @brief Interrupt handler for the rtc second increments
+         * 
+         */
+        static void irq_handler() {
+            // clear the counter increment interrupt
+            RtcPeriph::port->ILR = 0x1;
+
+            edge_time = klib::io::systick<>::template get_runtime<klib::time::us>().value;
+            edges = edges + 1;
+        }
+
+        /**
+         * @brief Wait until a flag of the serial interface engine
+         * is set. Returns false when the engine does not respond
+         * 
+         * @param flag 
+         * @return true 
+         * @return false 
+         */
+        static bool wait_flag(const uint32_t flag) {
+            for (uint32_t i = 0; i < max_polls; i++) {
+                if (UsbPeriph::port->DEVINTST & flag) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /**
+         * @brief Read the current frame number using the serial
+         * interface engine of the usb. Should be called with the
+         * interrupts disabled so we do not interfere with the
+         * usb driver. Returns false on a timeout
+         * 
+         * @param frame 
+         * @return true 
+         * @return false 
+         */
+        static bool read_frame(uint32_t& frame) {
+            // command and data ready flags
+            constexpr static uint32_t command_empty = 0x1 << 4;
+            constexpr static uint32_t data_full = 0x1 << 5;
+
+            // send the read current frame number command
+            UsbPeriph::port->DEVINTCLR = command_empty | data_full;
+            UsbPeriph::port->CMDCODE = 0x00f50500;
+
+            if (!wait_flag(command_empty)) {
+                return false;
+            }
+
+            UsbPeriph::port->DEVINTCLR = command_empty;
+
+            // read the low and the high byte
+            uint32_t ret = 0;
+
+            for (uint32_t i = 0; i < 2; i++) {
+                UsbPeriph::port->CMDCODE = 0x00f50200;
+
+                if (!wait_flag(data_full)) {
+                    return false;
+                }
+
+                ret |= (UsbPeriph::port->CMDDATA & 0xff) << (i * 8);
+                UsbPeriph::port->DEVINTCLR = data_full;
+            }
+
+            frame = ret & frame_mask;
+
+            return true;
+        }
+
+        /**
+         * @brief Start a new window at a edge
+         * 
+         * @param frame 
+         * @param time 
+         * @param second 
+         */
+        static void restart(const uint32_t frame, const uint32_t time, const uint32_t second) {
+            started = true;
+
+            last_frame = frame;
+            last_time = time;
+            last_second = second;
+
+            seconds = 0;
+            frames = 0;
+        }
+
+        /**
+         * @brief Calculate the drift of the window we completed
+         * 
+         */
+        static void complete() {
+            started = false;
+
+            // the calibration steps are not in the seconds so this 
+            // is the drift of the rtc itself
+            const int64_t expected = static_cast<int64_t>(seconds) * 1000;
+
+            last_estimate = ((expected - frames) * ppb) / frames;
+            valid = true;
+
+            // update the calibration when requested
+            if (is_automatic<RtcPeriph>()) {
+                drift::apply<RtcPeriph>(last_estimate);
+            }
+        }
+
+    public:
+        /**
+         * @brief Init the estimator. The rtc should already be
+         * initialized
+         * 
+         */
+        static void init() {
+            // enable the interrupt on every increment of the seconds
+            RtcPeriph::port->CIIR |= 0x1;
+            RtcPeriph::port->ILR = 0x1;
+
+            // register our interrupt handler and enable it
+            klib::target::irq::register_irq<RtcPeriph::interrupt_id>(irq_handler);
+            NVIC_EnableIRQ(static_cast<IRQn_Type>(RtcPeriph::interrupt_id - 16));
+        }
+
+        /**
+         * @brief Handle the rtc seconds we got. Should be called
+         * from the main loop at least every few seconds
+         * 
+         */
+        static void update() {
+            if (handled == edges) {
+                return;
+            }
+
+            // we can only use the frames when the host is sending them
+            if (!Usb::device::template is_configured<Usb>()) {
+                handled = edges;
+                started = false;
+
+                return;
+            }
+
+            klib::target::disable_irq();
+
+            // skip when the rtc changed after the interrupt. We
+            // handle it when the interrupt is done
+            if (RtcPeriph::port->ILR & 0x1) {
+                klib::target::enable_irq();
+
+                return;
+            }
+
+            const uint32_t count = edges;
+            const uint32_t time = edge_time;
+            const uint32_t second = RtcPeriph::port->SEC;
+            uint32_t frame = 0;
+            const bool read = read_frame(frame);
+            const uint32_t now = klib::io::systick<>::template get_runtime<klib::time::us>().value;
+
+            klib::target::enable_irq();
+
+            handled = count;
+
+            // drop the window when the usb did not respond
+            if (!read) {
+                started = false;
+
+                return;
+            }
+
+            // get the frame number at the time of the edge
+            const uint32_t edge_frame = (frame - ((now - time) / 1000)) & frame_mask;
+
+            if (!started) {
+                restart(edge_frame, time, second);
+
+                return;
+            }
+
+            // restart if we did not run for too long
+            if ((time - last_time) > max_gap) {
+                restart(edge_frame, time, second);
+
+                return;
+            }
+
+            // the systick tells us how many frames should have been
+            // sent. Use it to unwrap the frame number
+            const uint32_t elapsed = (time - last_time) / 1000;
+            int32_t difference = static_cast<int32_t>((edge_frame - last_frame - elapsed) & frame_mask);
+
+            if (difference > static_cast<int32_t>(frame_mask / 2)) {
+                difference -= static_cast<int32_t>(frame_mask + 1);
+            }
+
+            // restart when the host stopped sending frames
+            if ((difference > max_jitter) || (difference < -max_jitter)) {
+                restart(edge_frame, time, second);
+
+                return;
+            }
+
+            // get the rtc increments and the frames since the last edge
+            const uint32_t increments = (second + 60 - last_second) % 60;
+            const uint32_t interval = elapsed + difference;
+
+            // the drift never adds up to half a second between two 
+            // edges. Any difference between the increments and the
+            // frames is a calibration step. A forward step adds a 
+            // second, a backward step stops the rtc for a second
+            const int32_t steps = static_cast<int32_t>(increments) - 
+                static_cast<int32_t>((interval + 500) / 1000);
+
+            // more than a single step means the rtc was set
+            if ((steps > 1) || (steps < -1)) {
+                restart(edge_frame, time, second);
+
+                return;
+            }
+
+            seconds += increments - steps;
+            frames += interval;
+
+            last_frame = edge_frame;
+            last_time = time;
+            last_second = second;
+
+            if (seconds >= Window) {
+                complete();
+            }
+        }
+
+        /**
+         * @brief Returns if we are measuring a window. The window 
+         * uses the systick to match the frames to the rtc seconds
+         * 
+         * @return true 
+         * @return false 
+         */
+        static bool is_running() {
+            return started;
+        }
+
+        /**
+         * @brief Returns if we have a estimate
+         * 
+         * @return true 
+         * @return false 
+         */
+        static bool has_estimate() {
+            return valid;
+        }
+
+        /**
+         * @brief Get the last estimate of the drift of the rtc
+         * without calibration in parts per billion. Positive when
+         * the rtc runs fast
+         * 
+         * @return int64_t 
+         */
+        static int64_t estimate() {
+            return last_estimate;
+        }
+
+        /**
+         * @brief Apply the last estimate to the rtc calibration
+         * 
+         */
+        static void apply() {
+            if (!valid) {
+                return;
+            }
+
+            drift::apply<RtcPeriph>(last_estimate);
+        }
+    };
+}
@@ -0,0 +1,401 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <utility>
+
+namespace hmac {
+    /**
+     * @brief Sha1 state after a amount of blocks
+     * 
+     */
+    using digest = std::array<uint32_t, 5>;
+
+    /**
+     * @brief Sha1 states after the inner and outer padded key
+     * block. These only depend on the key and can be calculated
+     * once for every profile
+     * 
+     */
+    struct midstate {
+        // state after the key xor ipad block
+        digest inner;
+
+        // state after the key xor opad block
+        digest outer;
+    };
+
+    namespace detail {
+        // size of a single sha1 block in bytes
+        constexpr static uint32_t block_size = 64;
+
+        // initial sha1 state
+        constexpr static digest initial = {
+            0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+        };
+
+        /**
+         * @brief Rotate a value left
+         * 
+         * @param value 
+         * @param shift 
+         * @return uint32_t 
+         */
+        constexpr uint32_t rotl(const uint32_t value, const uint32_t shift) {
+            return (value << shift) | (value >> (32 - shift));
+        }
+
+        /**
+         * @brief Run the sha1 compression function on a single block
+         * 
+         * @param state 
+         * @param block 
+         */
+        constexpr void compress(digest& state, const std::array<uint32_t, 16>& block) {
+            // message schedule
+            std::array<uint32_t, 80> w = {};
+
+            for (uint32_t i = 0; i < 16; i++) {
+                w[i] = block[i];
+            }
+
+            for (uint32_t i = 16; i < 80; i++) {
+                w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+            }
+
+            uint32_t a = state[0];
+            uint32_t b = state[1];
+            uint32_t c = state[2];
+            uint32_t d = state[3];
+            uint32_t e = state[4];
+
+            for (uint32_t i = 0; i < 80; i++) {
+                uint32_t f;
+                uint32_t k;
+
+                if (i < 20) {
+                    f = (b & c) | ((~b) & d);
+                    k = 0x5a827999;
+                }
+                else if (i < 40) {
+                    f = b ^ c ^ d;
+                    k = 0x6ed9eba1;
+                }
+                else if (i < 60) {
+                    f = (b & c) | (b & d) | (c & d);
+                    k = 0x8f1bbcdc;
+                }
+                else {
+                    f = b ^ c ^ d;
+                    k = 0xca62c1d6;
+                }
+
+                const uint32_t t = rotl(a, 5) + f + e + k + w[i];
+
+                e = d;
+                d = c;
+                c = rotl(b, 30);
+                b = a;
+                a = t;
+            }
+
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+        }
+
+        /**
+         * @brief Hash the padded key block and return the state
+         * 
+         * @param key 
+         * @param size 
+         * @param pad 
+         * @return digest 
+         */
+        constexpr digest key_state(const uint8_t* key, const uint32_t size, const uint8_t pad) {
+            std::array<uint32_t, 16> block = {};
+
+            // xor the (zero extended) key with the padding
+            for (uint32_t i = 0; i < block_size; i++) {
+                const uint8_t value = ((i < size) ? key[i] : 0x00) ^ pad;
+
+                block[i / 4] |= static_cast<uint32_t>(value) << (24 - ((i % 4) * 8));
+            }
+
+            digest state = initial;
+            compress(state, block);
+
+            return state;
+        }
+
+        /**
+         * @brief Finish a sha1 hash that already processed a single
+         * block with a message that fits in the last block
+         * 
+         * @param state 
+         * @param message 
+         * @param size 
+         * @return digest 
+         */
+        constexpr digest finish(const digest& state, const uint8_t* message, const uint32_t size) {
+            std::array<uint32_t, 16> block = {};
+
+            // copy the message into the block
+            for (uint32_t i = 0; i < size; i++) {
+                block[i / 4] |= static_cast<uint32_t>(message[i]) << (24 - ((i % 4) * 8));
+            }
+
+            // add the end marker after the message
+            block[size / 4] |= static_cast<uint32_t>(0x80) << (24 - ((size % 4) * 8));
+
+            // add the length in bits. Includes the key block
+            block[15] = (block_size + size) * 8;
+
+            digest ret = state;
+            compress(ret, block);
+
+            return ret;
+        }
+
+        /**
+         * @brief Run a single round of the unrolled sha1 compression. 
+         * The message schedule is kept in a 16 word window that is 
+         * updated in place. As the round is a template parameter all
+         * the indices and constants are resolved at compile time
+         * 
+         * @tparam Round 
+         * @param v 
+         * @param w 
+         */
+        template <uint32_t Round>
+        constexpr void round(std::array<uint32_t, 5>& v, std::array<uint32_t, 16>& w) {
+            // expand the message schedule for the rounds after the 
+            // first block
+            if constexpr (Round >= 16) {
+                w[Round % 16] = rotl(
+                    w[(Round - 3) % 16] ^ w[(Round - 8) % 16] ^ 
+                    w[(Round - 14) % 16] ^ w[Round % 16], 1
+                );
+            }
+
+            // get the working variables for this round. Instead of 
+            // moving the variables around every round the index 
+            // rotates
+            uint32_t& a = v[(80 - Round) % 5];
+            uint32_t& b = v[(81 - Round) % 5];
+            const uint32_t c = v[(82 - Round) % 5];
+            const uint32_t d = v[(83 - Round) % 5];
+            uint32_t& e = v[(84 - Round) % 5];
+
+            if constexpr (Round < 20) {
+                e += rotl(a, 5) + (d ^ (b & (c ^ d))) + 0x5a827999 + w[Round % 16];
+            }
+            else if constexpr (Round < 40) {
+                e += rotl(a, 5) + (b ^ c ^ d) + 0x6ed9eba1 + w[Round % 16];
+            }
+            else if constexpr (Round < 60) {
+                e += rotl(a, 5) + ((b & c) | (d & (b | c))) + 0x8f1bbcdc + w[Round % 16];
+            }
+            else {
+                e += rotl(a, 5) + (b ^ c ^ d) + 0xca62c1d6 + w[Round % 16];
+            }
+
+            // rotate b. This becomes c in the next round
+            b = rotl(b, 30);
+        }
+
+        /**
+         * @brief Run all the rounds of the compression
+         * 
+         * @tparam Rounds 
+         * @param v 
+         * @param w 
+         */
+        template <uint32_t... Rounds>
+        constexpr void rounds(std::array<uint32_t, 5>& v, std::array<uint32_t, 16>& w, 
+            std::integer_sequence<uint32_t, Rounds...>) 
+        {
+            (round<Rounds>(v, w), ...);
+        }
+
+        /**
+         * @brief Compress a single block that contains a message of 
+         * a fixed amount of words after a block that is already 
+         * hashed. The padding and the length are compile time 
+         * constants so they do not need to be written at runtime
+         * 
+         * @tparam Words 
+         * @param state 
+         * @param message 
+         * @return digest 
+         */
+        template <uint32_t Words>
+        constexpr digest compress_fixed(const digest& state, const std::array<uint32_t, Words>& message) {
+            // the message, end marker and the length should fit in 
+            // a single block
+            static_assert(Words <= 13, "Message does not fit in a single block");
+
+            // message schedule layout. The words after the message are
+            // fixed: the end marker, zeros and the length in bits 
+            // (including the key block)
+            std::array<uint32_t, 16> w = {};
+
+            for (uint32_t i = 0; i < Words; i++) {
+                w[i] = message[i];
+            }
+
+            w[Words] = 0x80000000;
+            w[15] = (block_size + (Words * sizeof(uint32_t))) * 8;
+
+            // run the unrolled rounds
+            std::array<uint32_t, 5> v = state;
+            rounds(v, w, std::make_integer_sequence<uint32_t, 80>{});
+
+            return {
+                state[0] + v[0], state[1] + v[1], state[2] + v[2], 
+                state[3] + v[3], state[4] + v[4]
+            };
+        }
+    }
+
+    /**
+     * @brief Calculate the midstates for a key. Keys longer than
+     * a sha1 block are not supported (a profile key is at most 40
+     * bytes)
+     * 
+     * @param key 
+     * @param size 
+     * @return midstate 
+     */
+    constexpr midstate precompute(const uint8_t* key, const uint32_t size) {
+        return {
+            detail::key_state(key, size, 0x36),
+            detail::key_state(key, size, 0x5c)
+        };
+    }
+
+    /**
+     * @brief Generic hmac sha1 kernel for the totp counter. Converts 
+     * the message to bytes and pads it at runtime
+     * 
+     */
+    struct sha1 {
+        /**
+         * @brief Calculate the hmac of the counter using the 
+         * midstates of the key
+         * 
+         * @param state 
+         * @param counter 
+         * @return digest 
+         */
+        constexpr static digest hash(const midstate& state, const uint64_t counter) {
+            // message for the inner hash is the counter as big endian
+            std::array<uint8_t, 8> message = {};
+
+            for (uint32_t i = 0; i < message.size(); i++) {
+                message[i] = static_cast<uint8_t>(counter >> (56 - (i * 8)));
+            }
+
+            // calculate the inner hash
+            const digest inner = detail::finish(state.inner, message.data(), message.size());
+
+            // convert the inner hash to bytes for the outer hash
+            std::array<uint8_t, 20> inner_bytes = {};
+
+            for (uint32_t i = 0; i < inner_bytes.size(); i++) {
+                inner_bytes[i] = static_cast<uint8_t>(inner[i / 4] >> (24 - ((i % 4) * 8)));
+            }
+
+            // calculate the outer hash
+            return detail::finish(state.outer, inner_bytes.data(), inner_bytes.size());
+        }
+    };
+
+    /**
+     * @brief Hmac sha1 kernel specialized for the totp counter. The 
+     * inner message is always 2 words (the counter) and the outer 
+     * message is always 5 words (the inner digest). Both blocks have
+     * a constant length and padding and use the unrolled compression
+     * 
+     */
+    struct sha1_totp {
+        /**
+         * @brief Calculate the hmac of the counter using the 
+         * midstates of the key
+         * 
+         * @param state 
+         * @param counter 
+         * @return digest 
+         */
+        constexpr static digest hash(const midstate& state, const uint64_t counter) {
+            // the counter is already in the word layout of sha1
+            const digest inner = detail::compress_fixed<2>(state.inner, {
+                static_cast<uint32_t>(counter >> 32), static_cast<uint32_t>(counter)
+            });
+
+            // the inner digest is used directly as the outer message
+            return detail::compress_fixed<5>(state.outer, inner);
+        }
+    };
+
+    /**
+     * @brief Calculate a totp token using the midstates of the key
+     * 
+     * @tparam Hash hmac kernel to use 
+     * @param state 
+     * @param counter 
+     * @param digits 
+     * @return uint32_t 
+     */
+    template <typename Hash = sha1_totp>
+    constexpr uint32_t totp(const midstate& state, const uint64_t counter, const uint32_t digits) {
+        // get the hmac of the counter
+        const digest hash = Hash::hash(state, counter);
+
+        // get the offset from the last nibble
+        const uint32_t offset = hash[4] & 0xf;
+
+        // get the 4 bytes at the offset. These can span 2 words
+        const uint32_t word = offset / 4;
+        const uint32_t shift = (offset % 4) * 8;
+
+        const uint32_t code = (shift ? 
+            ((hash[word] << shift) | (hash[word + 1] >> (32 - shift))) : 
+            hash[word]
+        ) & 0x7fffffff;
+
+        // get the modulo for the amount of digits
+        uint32_t mod = 1;
+
+        for (uint32_t i = 0; i < digits; i++) {
+            mod *= 10;
+        }
+
+        return code % mod;
+    }
+
+    namespace detail {
+        // key used in the rfc 6238 sha1 test vectors
+        constexpr static uint8_t rfc6238_key[] = {
+            '1', '2', '3', '4', '5', '6', '7', '8', '9', '0',
+            '1', '2', '3', '4', '5', '6', '7', '8', '9', '0'
+        };
+
+        // midstates of the test key
+        constexpr static midstate rfc6238_state = precompute(rfc6238_key, sizeof(rfc6238_key));
+    }
+
+    // validate both kernels against the rfc 6238 sha1 test vectors (30
+    // second interval, 8 digits)
+    static_assert(totp<sha1>(detail::rfc6238_state, 59 / 30, 8) == 94287082, "Invalid hmac");
+    static_assert(totp<sha1>(detail::rfc6238_state, 1111111109 / 30, 8) == 7081804, "Invalid hmac");
+    static_assert(totp<sha1>(detail::rfc6238_state, 20000000000 / 30, 8) == 65353130, "Invalid hmac");
+    static_assert(totp<sha1_totp>(detail::rfc6238_state, 59 / 30, 8) == 94287082, "Invalid hmac");
+    static_assert(totp<sha1_totp>(detail::rfc6238_state, 1111111109 / 30, 8) == 7081804, "Invalid hmac");
+    static_assert(totp<sha1_totp>(detail::rfc6238_state, 1111111111 / 30, 8) == 14050471, "Invalid hmac");
+    static_assert(totp<sha1_totp>(detail::rfc6238_state, 1234567890 / 30, 8) == 89005924, "Invalid hmac");
+    static_assert(totp<sha1_totp>(detail::rfc6238_state, 2000000000 / 30, 8) == 69279037, "Invalid hmac");
+    static_assert(totp<sha1_totp>(detail::rfc6238_state, 20000000000 / 30, 8) == 65353130, "Invalid hmac");
+}
@@ -14,7 +14,12 @@
 #include "ui/mouse.hpp"
 
 #include "button.hpp"
+#include "button_events.hpp"
 #include "storage.hpp"
+#include "pipeline.hpp"
+#include "usb_switch.hpp"
+#include "power.hpp"
+#include "drift.hpp"
 
 #include <io/ssp.hpp>
 #include <io/rtc.hpp>
@@ -39,7 +44,15 @@ constexpr static klib::time::ms screen_timeout = 60'000;
 constexpr static uint32_t fps_frametime = (1'000'000) / 60;
 
 // using for the ssp (spi port)
-using ssp = klib::target::io::ssp<klib::target::io::periph::lqfp_80::ssp1<>>;
+using ssp_periph = klib::target::io::periph::lqfp_80::ssp1<>;
+using ssp = klib::target::io::ssp<ssp_periph>;
+
+// dma request of the transmit side of ssp1
+constexpr static uint32_t ssp_tx_request = 2;
+
+// offset of the screen in the memory of the display
+constexpr static uint32_t display_offset_x = 40;
+constexpr static uint32_t display_offset_y = 52;
 
 // using for the display io
 using blk = klib::target::io::pin_out<klib::target::pins::package::lqfp_80::p60>;
@@ -85,14 +98,16 @@ int main() {
     using dma = target::io::dma<dma_periph>;
     dma::init<std::endian::big>();
 
-    // create the dma channels
-    using dma_tx = target::io::dma_channel<dma_periph, 0, klib::io::dma::memory, ssp>;
+    // create the dma channels. The render pipeline takes over the
+    // tx channel after the display is initialized
+    constexpr static uint32_t dma_tx_channel = 0;
+    using dma_tx = target::io::dma_channel<dma_periph, dma_tx_channel, klib::io::dma::memory, ssp>;
     using dma_rx = target::io::dma_channel<dma_periph, 1, ssp, klib::io::dma::memory>;
 
     dma_tx::init();
     dma_rx::init();
 
-    using display = klib::hardware::display::st7789_dma<dma_tx, dma_rx, ssp, dc, rst, klib::graphics::mode::rgb565, 240, 135, 40, 52>;
+    using display = klib::hardware::display::st7789_dma<dma_tx, dma_rx, ssp, dc, rst, klib::graphics::mode::rgb565, 240, 135, display_offset_x, display_offset_y>;
 
     // init the buttons
     button0::init();
@@ -102,6 +117,11 @@ int main() {
     // check if any of the buttons is pressed
     const bool flipped = button0::get() || button2::get();
 
+    // get the button changes using the edge interrupts. The 
+    // buttons that are down now are ignored until they are released
+    using button_events = input::events<button0, button1, button2>;
+    button_events::init();
+
     // initialize the display in the correct orientation. We flip the screen
     // if any of the buttons are pressed while we are powered on
     if (flipped) {
@@ -116,25 +136,56 @@ int main() {
     ssp::clear_rx_fifo();
 
     // create the framebuffers
-    constexpr static uint32_t move_height = 10;
+    constexpr static uint32_t move_height = 8;
     using fb_t = klib::graphics::movable_framebuffer<display, display::mode, 0, 0, display::width, move_height, std::endian::big>;
 
+    // amount of framebuffers we alternate between. 3 framebuffers 
+    // of 3840 bytes fit in RAM1 together with the buffers of the 
+    // usb mass storage (see ui/config.hpp) 
+    constexpr static uint32_t framebuffer_count = 3;
+
     // this needs to be static to move it to RAM1. 
-    static std::array<fb_t, 2> framebuffer __attribute__ ((section(".framebuffer"))) = {fb_t(), fb_t()};
+    static std::array<fb_t, framebuffer_count> framebuffer __attribute__ ((section(".framebuffer"))) = {
+        fb_t(), fb_t(), fb_t()
+    };
 
     // init all the framebuffers
     for (auto& fb: framebuffer) {
         fb.init();
     }
 
+    // pipeline that sends the framebuffers to the display
+    using pipeline = render::pipeline<
+        fb_t, framebuffer_count, dma_periph, dma_tx_channel, ssp_tx_request, 
+        ssp, ssp_periph, dc, display_offset_x, display_offset_y
+    >;
+    pipeline::init(framebuffer);
+
     // setup the usb pll
     target::io::system::clock::set_usb<12'000'000>();
 
     // using for writing to flash
     using flash = target::io::flash;
 
+    // ram the storage uses while it erases the profile sector. The
+    // framebuffers are only used while we draw a frame
+    struct staging {
+        static std::span<uint8_t> get() {
+            // wait until the dma is done with the framebuffers
+            pipeline::wait();
+
+            return {reinterpret_cast<uint8_t*>(framebuffer.data()), sizeof(framebuffer)};
+        }
+    };
+
     // using for the storage
-    using storage = storage::storage<flash>;
+    using storage = storage::storage<flash, staging>;
+
+    static_assert(sizeof(framebuffer) >= storage::staging_size, "Framebuffers too small for the storage staging");
+
+    // using for the rtc drift estimator. Uses the start of frame
+    // of the host while we are connected as a keyboard
+    using drift = drift::estimator<rtc_periph, target::io::periph::lqfp_80::usb0, usb_keyboard>;
 
     // create the popup first as some other screens use it
     menu::numeric_popup<fb_t> numeric_popup = {};
@@ -144,12 +195,12 @@ int main() {
     // except the screen in the splash screen. This speeds
     // up the boot time and will show the splash screen
     // until we are done initializing. 
-    menu::splash<fb_t, storage, rtc, usb_keyboard> splash = {};
+    menu::splash<fb_t, storage, rtc, usb_keyboard, drift> splash = {};
     menu::totp<fb_t, storage, rtc, rtc_periph, usb_keyboard> totp = {};
     menu::settings<fb_t> settings = {};
     menu::time<fb_t, rtc_periph, rtc> time(numeric_popup);
     menu::timezone<fb_t, rtc_periph> timezone(numeric_popup);
-    menu::calibration<fb_t, rtc_periph> calibration(numeric_popup, string_popup);
+    menu::calibration<fb_t, rtc_periph, drift> calibration(numeric_popup, string_popup);
     menu::config<
         fb_t, storage, fat_helper, 
         usb_keyboard, usb_massstorage
@@ -173,11 +224,20 @@ int main() {
     // get the current screen
     uint8_t previous_screen = static_cast<uint8_t>(menu::screen<fb_t>::get());
 
-    // call activate on the first screen
+    // call activate on the first screen and mark it as
+    // changed to draw it completely
     screens[previous_screen]->activate(menu::screen_id::splash);
+    screens[previous_screen]->invalidate();
+
+    // idle mode after the screen timeout
+    using idle = power::idle<ssp, dc, blk>;
+
+    // usb activity that wakes us up from the idle mode
+    using usb_wake = power::usb_wake<target::io::periph::lqfp_80::usb0, USB_IRQn>;
 
-    // current active framebuffer
-    uint8_t current_framebuffer = 0;
+    // flag if we ignore the buttons until they are released. Used
+    // for the button that wakes us up from the idle mode
+    bool ignore_buttons = false;
 
     // last time the user pressed a button for the screen timeout
     auto last_pressed_time = klib::io::systick<>::template get_runtime();
@@ -185,48 +245,58 @@ int main() {
     // get the previous time for the delta
     auto previous_time = klib::io::systick<>::get_runtime<klib::time::us>();
 
-    // timing for the buttons. To keep track on how long a 
-    // button is pressed. We mark everything with the pressed
-    // marker to make sure we do not enter a menu straight 
-    // away
-    std::array<klib::time::us, 3> button_timing = {
-        input::pressed_marker, input::pressed_marker, 
-        input::pressed_marker
-    };
-
     while (true) {
         // get the current screen
         const uint8_t current_screen = static_cast<uint8_t>(menu::screen<fb_t>::get());
 
+        // wake up on the first edge of a button. This starts waking
+        // the display while the button is still down
+        if (idle::is_active() && button_events::pending()) {
+            idle::exit();
+
+            // prevent the button from triggering anything when we 
+            // wake up
+            ignore_buttons = true;
+
+            // restart the screen timeout
+            last_pressed_time = klib::io::systick<>::get_runtime();
+        }
+
+        // send the next wake up command when the display had time
+        // for the previous one. We draw again when it is awake
+        idle::update();
+
         // get the current time
         const auto current_time = klib::io::systick<>::template get_runtime<klib::time::us>();
 
-        // get the buttons
-        input::buttons buttons = input::get_state(
-            current_time - previous_time, flipped, button_timing, 
-            {button0::get(), button1::get(), button2::get()}
-        );
+        // get the buttons using the timestamps of the edges
+        input::buttons buttons = button_events::get_state(current_time, flipped);
+
+        if (ignore_buttons) {
+            buttons = {input::state::no_change, input::state::no_change, input::state::no_change};
+
+            // keep ignoring the buttons until all of them are released
+            ignore_buttons = button_events::held() || button_events::pending();
+        }
 
         // flag if we have reached the screen timeout
         const bool timeout = klib::io::systick<>::get_runtime() > (last_pressed_time + screen_timeout);
 
         // check if we have pressed any button
         if (is_pressed(buttons.up) || is_pressed(buttons.enter) || is_pressed(buttons.down)) {
-            // check if we need to enable the backlight again
-            if (timeout) {
-                // turn on the backlight
-                blk::set<false>();
-
-                // prevent any of the buttons from triggering when we turn on the backlight
-                buttons = {input::state::no_change, input::state::no_change, input::state::no_change};
-            }
-
             // update the last time we pressed the buttons
             last_pressed_time = klib::io::systick<>::get_runtime();
         }
-        else if (timeout) {
-            // turn off the backlight
-            blk::set<true>();
+        else if (timeout && !idle::is_active()) {
+            // wait until the last framebuffer is on the display 
+            // before we put it to sleep
+            pipeline::wait();
+
+            // turn off the backlight and the display
+            idle::enter();
+
+            // only usb activity after this wakes us up
+            usb_wake::stop();
         }
 
         // check if we have switched screens
@@ -241,6 +311,10 @@ int main() {
                 static_cast<menu::screen_id>(previous_screen)
             );
 
+            // the new screen has not been drawn yet. Mark 
+            // everything as changed
+            screens[current_screen]->invalidate();
+
             // set the current screen as the previous screen for a next change
             previous_screen = current_screen;
 
@@ -248,48 +322,155 @@ int main() {
             previous_time = current_time;
         }
 
+        // connect the new usb device when the host had time to 
+        // detect the old one is gone. Redraw to remove the progress
+        if (usb::switcher::update()) {
+            screens[current_screen]->invalidate();
+        }
+
+        // handle the rtc seconds for the drift estimate
+        drift::update();
+
         // run the correct screen
         screens[current_screen]->main(current_time - previous_time, buttons);
 
-        // draw the screen alternating the framebuffers
-        for (uint32_t i = 0; i < display::height; i += move_height) {
-            // call the on_draw
-            screens[current_screen]->draw(
-                framebuffer[current_framebuffer], {0, i}
-            );
-
-            // wait until the previous segment is done until we update it
-            while (dma_tx::is_busy()) {
-                // wait
+        // draw the screen using the framebuffers in the pipeline. We
+        // do not draw anything while the display is sleeping. The
+        // damage is kept until we wake up
+        for (uint32_t i = 0; (i < display::height) && !idle::is_active(); i += move_height) {
+            // skip the strip if nothing changed in it since the 
+            // last frame. The display still has the old data
+            if (!screens[current_screen]->is_damaged(
+                klib::vector2i{0, static_cast<int32_t>(i)}, 
+                klib::vector2i{static_cast<int32_t>(display::width), static_cast<int32_t>(i + move_height)}))
+            {
+                continue;
             }
 
-            // after the dma signals it is done we still have data in the
-            // ssp fifo. Wait until we are done with that as well before
-            // we write new data
-            while (ssp::is_busy()) {
-                // wait
-            }
+            // get a framebuffer that is not in use. Sleeps until the
+            // dma is done with one if all of them are queued
+            auto& fb = pipeline::acquire();
 
-            // clear any data left in the fifo register to prevent 
-            // stalls when we use the dma later
-            ssp::clear_rx_fifo();
+            // call the on_draw
+            screens[current_screen]->draw(fb, {0, i});
 
-            // flush the framebuffer to the display
-            framebuffer[current_framebuffer].flush(klib::vector2u(0, i));
+            // queue the framebuffer to be written to the display. It
+            // is started when the previous one is done
+            pipeline::submit(i);
+        }
 
-            // swap the framebuffer we are using
-            current_framebuffer ^= 1;
+        if (!idle::is_active()) {
+            // everything that changed is on the display now
+            screens[current_screen]->clear_damage();
         }
 
         // update the previous time
         previous_time = current_time;
 
-        const auto end_time = klib::io::systick<>::template get_runtime<klib::time::us>();
+        // ask the screen when it needs to run again. When the 
+        // display is sleeping we only wake up for the buttons
+        uint32_t frametime = (idle::is_active() ? 
+            input::pressed_marker : screens[current_screen]->next_frame()
+        ).value;
+
+        // check if we still have button changes to handle
+        if (button_events::pending() || (static_cast<uint8_t>(menu::screen<fb_t>::get()) != current_screen)) {
+            // run the next frame as soon as possible
+            frametime = 0;
+        }
+        else {
+            // wake up when a button that is down becomes a long press
+            frametime = klib::min(frametime, static_cast<uint32_t>(
+                button_events::next_deadline(klib::io::systick<>::template get_runtime<klib::time::us>()).value
+            ));
+        }
+
+        if (!timeout) {
+            // make sure we wake up in time to turn off the backlight
+            const auto timeout_time = last_pressed_time + screen_timeout;
+            const auto now = klib::io::systick<>::get_runtime();
+
+            if (timeout_time > now) {
+                frametime = klib::min(frametime, static_cast<uint32_t>((timeout_time - now).value * 1000));
+            }
+        }
+
+        // wake up in time to connect the new usb device
+        if (usb::switcher::busy()) {
+            frametime = klib::min(frametime, static_cast<uint32_t>(usb::switcher::remaining().value));
+        }
+
+        // wake up in time for the next step of waking the display
+        if (idle::is_waking()) {
+            frametime = klib::min(frametime, static_cast<uint32_t>(idle::remaining().value));
+        }
+
+        // we try to target around 60 fps at most
+        frametime = klib::max(frametime, fps_frametime);
+
+        // sleep until the screen needs a new frame
+        while ((klib::io::systick<>::template get_runtime<klib::time::us>() - current_time).value < frametime) {
+            // stop sleeping when a button changed. The edge 
+            // interrupt wakes us up
+            if (button_events::pending()) {
+                break;
+            }
+
+            // wake up when the host is active after the usb woke 
+            // us up
+            if (idle::is_active() && usb_wake::update()) {
+                idle::exit();
+
+                // restart the screen timeout
+                last_pressed_time = klib::io::systick<>::get_runtime();
+
+                break;
+            }
+
+            // handle the rtc seconds for the drift estimate
+            drift::update();
+
+            // draw as soon as the display is awake
+            if (idle::update()) {
+                break;
+            }
+
+            // start the next queued strip when the dma interrupt
+            // woke us up
+            pipeline::update();
+
+            // let the screen do background work before we sleep
+            if (screens[current_screen]->idle()) {
+                continue;
+            }
+
+            // wait for the next interrupt. The interrupts are 
+            // disabled while we check the buttons. An edge between 
+            // the check and the sleep stays pending and still wakes
+            // us up
+            klib::target::disable_irq();
+
+            if (!button_events::pending()) {
+                // while the display sleeps and nothing needs the 
+                // runtime to advance the systick is stopped as well.
+                // Only the buttons, the usb and the rtc wake us up
+                if (idle::is_active() && !idle::is_waking() && 
+                    !usb::switcher::busy() && !drift::is_running() && 
+                    !usb_wake::is_checking()) 
+                {
+                    idle::sleep();
+                }
+                else {
+                    __WFI();
+                }
+
+                // check for the start of frames when the usb woke us
+                if (idle::is_active() && !idle::is_waking()) {
+                    usb_wake::woken();
+                }
+            }
 
-        // we try to target around 60 fps
-        if ((end_time - current_time).value < fps_frametime) {
-            // wait the remaining time
-            klib::delay(klib::time::us(fps_frametime - (end_time - current_time).value));
+            klib::target::enable_irq();
         }
     }
 }
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <array>
+#include <span>
+#include <cstdint>
+
+#include <klib/klib.hpp>
+#include <klib/math.hpp>
+
+namespace render {
+    /**
+     * @brief Pipeline that sends strips of the screen to the display
+     * using dma. The strips are queued and the next strip is started
+     * from the main loop when the previous one is done. The dma 
+     * interrupt only wakes up the cpu. This allows the cpu to draw 
+     * the next strip (or sleep) while the dma is busy
+     * 
+     * The pipeline sets up the transfers itself. The terminal count
+     * interrupt is only enabled on the last item of a transfer and
+     * is set before the channel is enabled. A strip that is bigger 
+     * than a single dma transfer is split using a linked list
+     * 
+     * @tparam FrameBuffer 
+     * @tparam Count 
+     * @tparam DmaPeriph 
+     * @tparam TxChannel dma channel we send the strips with 
+     * @tparam TxRequest dma request of the transmit side of the ssp 
+     * @tparam Ssp 
+     * @tparam SspPeriph 
+     * @tparam Dc 
+     * @tparam OffsetX offset of the screen in the memory of the display 
+     * @tparam OffsetY offset of the screen in the memory of the display 
+     */
+    template <
+        typename FrameBuffer, uint32_t Count, typename DmaPeriph,
+        uint32_t TxChannel, uint32_t TxRequest, typename Ssp, 
+        typename SspPeriph, typename Dc, uint32_t OffsetX, uint32_t OffsetY
+    >
+    class pipeline {
+    protected:
+        /**
+         * @brief Registers of a single dma channel
+         * 
+         */
+        struct channel {
+            volatile uint32_t SRCADDR;
+            volatile uint32_t DESTADDR;
+            volatile uint32_t LLI;
+            volatile uint32_t CONTROL;
+            volatile uint32_t CONFIG;
+        };
+
+        /**
+         * @brief Item of a linked list of transfers. The dma loads
+         * the next item into the channel when the current item is
+         * done
+         * 
+         */
+        struct list_item {
+            uint32_t source;
+            uint32_t destination;
+            uint32_t next;
+            uint32_t control;
+        };
+
+        // offset of the first channel and the size of every channel
+        constexpr static uint32_t channel_offset = 0x100;
+        constexpr static uint32_t channel_size = 0x20;
+
+        // max amount of transfers in a single item
+        constexpr static uint32_t max_transfers = 0xfff;
+
+        // bursts of 4 bytes for the source and the destination. The
+        // ssp requests data when its fifo is half empty. Bytes as 
+        // width with only the source address incrementing
+        constexpr static uint32_t control_transfer = (0x1 << 12) | (0x1 << 15) | (0x1 << 26);
+
+        // terminal count interrupt enable bit in the control register
+        constexpr static uint32_t control_interrupt = (0x1u << 31);
+
+        // enable bit, memory to peripheral transfer and the terminal
+        // count interrupt mask in the config register
+        constexpr static uint32_t config_enable = 0x1;
+        constexpr static uint32_t config_transfer = (TxRequest << 6) | (0x1 << 11);
+        constexpr static uint32_t config_interrupt = (0x1 << 15);
+
+        // st7789 commands to set the window and to write to its 
+        // memory
+        constexpr static uint8_t column_address = 0x2a;
+        constexpr static uint8_t row_address = 0x2b;
+        constexpr static uint8_t memory_write = 0x2c;
+
+        // bytes in a framebuffer (rgb565)
+        constexpr static uint32_t strip_size = FrameBuffer::width * FrameBuffer::height * 2;
+
+        // we send the framebuffer directly from its memory
+        static_assert(sizeof(FrameBuffer) == strip_size, "Framebuffer should only contain the pixels");
+
+        // amount of list items we need for a strip
+        constexpr static uint32_t item_count = (strip_size + max_transfers - 1) / max_transfers;
+
+        // list with the transfers of the strip we are sending. The 
+        // first item is loaded into the channel directly
+        static inline std::array<list_item, item_count> items = {};
+
+        // pointer to all the framebuffers we can use
+        static inline FrameBuffer* buffers = nullptr;
+
+        // offsets of the framebuffers that are queued
+        static inline std::array<uint32_t, Count> offsets = {};
+
+        // index of the next framebuffer we can draw in
+        static inline uint32_t write_index = 0;
+
+        // index of the framebuffer the dma is sending
+        static inline uint32_t read_index = 0;
+
+        // amount of framebuffers that are queued or being sent
+        static inline uint32_t used = 0;
+
+        // flag if the dma is sending a framebuffer
+        static inline bool busy = false;
+
+        /**
+         * @brief Get the registers of the tx channel
+         * 
+         * @return channel* 
+         */
+        static channel* tx_channel() {
+            return reinterpret_cast<channel*>(
+                reinterpret_cast<uintptr_t>(DmaPeriph::port) + channel_offset + (TxChannel * channel_size)
+            );
+        }
+
+        /**
+         * @brief Get the address of a object for the dma
+         * 
+         * @param object 
+         * @return uint32_t 
+         */
+        static uint32_t address(const volatile void* object) {
+            return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(object));
+        }
+
+        /**
+         * @brief Wait until the ssp has sent everything in its fifo
+         * 
+         */
+        static void wait_ssp() {
+            // the fifo is 8 frames deep so this is at most a few
+            // microseconds
+            while (Ssp::is_busy()) {
+                // wait
+            }
+        }
+
+        /**
+         * @brief Write a command with a start and a end address to 
+         * the display
+         * 
+         * @param command 
+         * @param start 
+         * @param end 
+         */
+        static void write_window(const uint8_t command, const uint32_t start, const uint32_t end) {
+            const uint8_t data[] = {
+                static_cast<uint8_t>(start >> 8), static_cast<uint8_t>(start),
+                static_cast<uint8_t>(end >> 8), static_cast<uint8_t>(end)
+            };
+
+            // write the command with the data/command pin low
+            Dc::template set<false>();
+            Ssp::write(std::span<const uint8_t>(&command, 1));
+            wait_ssp();
+
+            Dc::template set<true>();
+            Ssp::write(std::span<const uint8_t>(data));
+            wait_ssp();
+        }
+
+        /**
+         * @brief Start sending the framebuffer at the read index
+         * 
+         */
+        static void start() {
+            // after the dma is done we still have data in the ssp 
+            // fifo. Wait until we are done with that as well before 
+            // we change the window
+            wait_ssp();
+
+            // set the window of the strip in the memory of the 
+            // display
+            const uint32_t y = OffsetY + offsets[read_index];
+
+            write_window(column_address, OffsetX, OffsetX + FrameBuffer::width - 1);
+            write_window(row_address, y, y + FrameBuffer::height - 1);
+
+            // start writing to the memory of the display. Everything
+            // after this is pixel data
+            Dc::template set<false>();
+            Ssp::write(std::span<const uint8_t>(&memory_write, 1));
+            wait_ssp();
+            Dc::template set<true>();
+
+            // clear any data left in the fifo register to prevent
+            // stalls when we use the dma
+            Ssp::clear_rx_fifo();
+
+            // split the strip over the list items. Only the last item
+            // triggers the terminal count interrupt
+            const uint32_t source = address(&buffers[read_index]);
+
+            for (uint32_t i = 0; i < item_count; i++) {
+                const uint32_t offset = i * max_transfers;
+                const bool last = (i + 1) == item_count;
+
+                items[i] = {
+                    source + offset,
+                    address(&SspPeriph::port->DR),
+                    last ? 0 : address(&items[i + 1]),
+                    klib::min(max_transfers, strip_size - offset) | control_transfer | 
+                        (last ? control_interrupt : 0)
+                };
+            }
+
+            // load the first item while the channel is disabled. The
+            // channel disables itself when the previous transfer is
+            // done
+            channel *const tx = tx_channel();
+
+            tx->SRCADDR = items[0].source;
+            tx->DESTADDR = items[0].destination;
+            tx->LLI = items[0].next;
+            tx->CONTROL = items[0].control;
+
+            // mark we are sending
+            busy = true;
+
+            // enable the channel with the interrupt mask set
+            tx->CONFIG = config_transfer | config_interrupt | config_enable;
+        }
+
+        /**
+         * @brief Interrupt handler for the dma. Only clears the 
+         * interrupt. Waking up the cpu is enough for the main loop
+         * to start the next transfer
+         * 
+         */
+        static void irq_handler() {
+            // clear all the terminal count interrupts. The rx channel
+            // of the display can also trigger it
+            DmaPeriph::port->INTTCCLEAR = DmaPeriph::port->INTTCSTAT;
+        }
+
+        /**
+         * @brief Sleep until the next interrupt. Should be called 
+         * with the interrupts disabled
+         * 
+         */
+        static void sleep() {
+            // sleep until the dma is done. A pending interrupt 
+            // still wakes us up while the interrupts are disabled
+            __WFI();
+
+            // enable the interrupts to handle the interrupt
+            klib::target::enable_irq();
+        }
+
+    public:
+        /**
+         * @brief Init the pipeline. The display should be initialized
+         * before this is called. The pipeline takes over the tx 
+         * channel of the display
+         * 
+         * @param framebuffers 
+         */
+        static void init(std::array<FrameBuffer, Count>& framebuffers) {
+            buffers = framebuffers.data();
+
+            // make sure the ssp requests data from the dma
+            SspPeriph::port->DMACR = SspPeriph::port->DMACR | (0x1 << 1);
+
+            // register our interrupt handler and enable it. Nothing
+            // in the display driver waits for a dma interrupt, it 
+            // polls the busy flags of the channels
+            klib::target::irq::register_irq<DmaPeriph::interrupt_id>(irq_handler);
+            NVIC_EnableIRQ(static_cast<IRQn_Type>(DmaPeriph::interrupt_id - 16));
+        }
+
+        /**
+         * @brief Check if the current transfer is done and start the
+         * next one. Should be called from the main loop when it 
+         * wakes up
+         * 
+         */
+        static void update() {
+            // check if the current transfer is done
+            if (!busy || (tx_channel()->CONFIG & config_enable)) {
+                return;
+            }
+
+            // release the framebuffer we were sending
+            busy = false;
+            read_index = (read_index + 1) % Count;
+            used--;
+
+            // start the next framebuffer if we have any
+            if (used) {
+                start();
+            }
+        }
+
+        /**
+         * @brief Get a framebuffer we can draw in. Sleeps until a
+         * framebuffer is available when all of them are in use
+         * 
+         * @return FrameBuffer& 
+         */
+        static FrameBuffer& acquire() {
+            // wait until we have a framebuffer available
+            while (true) {
+                // disable the interrupts so the dma interrupt cannot
+                // fire between the check and the sleep
+                klib::target::disable_irq();
+                update();
+
+                // check if we can continue
+                if (used < Count) {
+                    klib::target::enable_irq();
+
+                    break;
+                }
+
+                // sleep until the dma is done
+                sleep();
+            }
+
+            return buffers[write_index];
+        }
+
+        /**
+         * @brief Sleep until all the queued framebuffers are sent
+         * to the display
+         * 
+         */
+        static void wait() {
+            while (true) {
+                // check if the transfer is done. Same as acquire
+                klib::target::disable_irq();
+                update();
+
+                if (!used) {
+                    klib::target::enable_irq();
+
+                    break;
+                }
+
+                // sleep until the dma is done
+                sleep();
+            }
+        }
+
+        /**
+         * @brief Queue the framebuffer we got with acquire to be
+         * written to the display
+         * 
+         * @param offset 
+         */
+        static void submit(const uint32_t offset) {
+            // store the offset of the framebuffer
+            offsets[write_index] = offset;
+
+            // move to the next framebuffer
+            write_index = (write_index + 1) % Count;
+
+            // check if we need to start the dma
+            used++;
+
+            if (!busy) {
+                start();
+            }
+        }
+    };
+}
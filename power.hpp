@@ -0,0 +1,330 @@
+#pragma once
+
+#include <span>
+#include <cstdint>
+
+#include <klib/klib.hpp>
+#include <klib/units.hpp>
+#include <klib/io/systick.hpp>
+
+namespace power {
+    /**
+     * @brief Idle mode after the screen timeout. Turns off the
+     * backlight and puts the display in sleep. The display keeps
+     * the contents of its memory while it sleeps, so only the
+     * parts that changed need to be sent after waking up
+     * 
+     * The ssp should not be in use (all the framebuffers in the
+     * render pipeline should be sent) when changing modes
+     * 
+     * @tparam Ssp 
+     * @tparam Dc 
+     * @tparam Blk 
+     */
+    template <typename Ssp, typename Dc, typename Blk>
+    class idle {
+    protected:
+        // st7789 commands to enter and exit the sleep mode
+        constexpr static uint8_t sleep_in = 0x10;
+        constexpr static uint8_t sleep_out = 0x11;
+
+        // time the display needs after a sleep command before it
+        // accepts the next sleep command
+        constexpr static klib::time::us sleep_delay = 120'000;
+
+        // time the display needs after a sleep out before it
+        // accepts pixel data
+        constexpr static klib::time::us wake_delay = 5'000;
+
+        // flag if we are in the idle mode. Stays set until the
+        // display is awake again
+        static inline bool active = false;
+
+        // flag if we are waking up the display and if we sent the
+        // sleep out command
+        static inline bool waking = false;
+        static inline bool woken = false;
+
+        // time we sent the last sleep command
+        static inline klib::time::us changed = {};
+
+        /**
+         * @brief Get the current runtime
+         * 
+         * @return klib::time::us 
+         */
+        static klib::time::us now() {
+            return klib::io::systick<>::template get_runtime<klib::time::us>();
+        }
+
+        /**
+         * @brief Returns the time left until the time has passed 
+         * since the last sleep command
+         * 
+         * @param time 
+         * @return klib::time::us 
+         */
+        static klib::time::us left(const klib::time::us time) {
+            const auto elapsed = now() - changed;
+
+            return (elapsed >= time) ? klib::time::us{} : (time - elapsed);
+        }
+
+        /**
+         * @brief Write a command without parameters to the display
+         * 
+         * @param command 
+         */
+        static void write_command(const uint8_t command) {
+            // wait until the previous data is out of the fifo
+            while (Ssp::is_busy()) {
+                // wait
+            }
+
+            // write the command with the data/command pin low
+            Dc::template set<false>();
+            Ssp::write(std::span<const uint8_t>(&command, 1));
+
+            while (Ssp::is_busy()) {
+                // wait
+            }
+
+            // clear the data we received while sending the command
+            // to prevent stalls when we use the dma
+            Ssp::clear_rx_fifo();
+
+            Dc::template set<true>();
+
+            changed = now();
+        }
+
+    public:
+        /**
+         * @brief Enter the idle mode
+         * 
+         */
+        static void enter() {
+            if (active) {
+                return;
+            }
+
+            // turn off the backlight
+            Blk::template set<true>();
+
+            // make sure the last wake up is done before we go back
+            // to sleep. The wake up was at least a screen timeout 
+            // ago so this normally does not wait
+            while (left(sleep_delay).value) {
+                // the systick wakes us up
+                __WFI();
+            }
+
+            // put the display in sleep. This stops the display
+            // from refreshing the panel
+            write_command(sleep_in);
+
+            active = true;
+        }
+
+        /**
+         * @brief Start exiting the idle mode. The display is woken 
+         * up from the main loop using update
+         * 
+         */
+        static void exit() {
+            if (!active) {
+                return;
+            }
+
+            waking = true;
+        }
+
+        /**
+         * @brief Wake up the display when it had enough time since
+         * the last command. Should be called from the main loop
+         * 
+         * @return true when the display is awake by this call 
+         * @return false 
+         */
+        static bool update() {
+            if (!waking || remaining().value) {
+                return false;
+            }
+
+            // the display needs some time after going to sleep
+            // before it can wake up again
+            if (!woken) {
+                write_command(sleep_out);
+
+                woken = true;
+
+                // wait until the display accepts data again
+                return false;
+            }
+
+            // turn on the backlight
+            Blk::template set<false>();
+
+            waking = false;
+            woken = false;
+            active = false;
+
+            return true;
+        }
+
+        /**
+         * @brief Sleep until the next interrupt with the systick 
+         * stopped. Otherwise the systick interrupt wakes us up every
+         * millisecond. The runtime does not advance while we sleep, 
+         * so this should only be used when nothing is waiting for
+         * a time to pass. Should be called with the interrupts 
+         * disabled so the interrupt that wakes us up is handled 
+         * after the systick is running again
+         * 
+         */
+        static void sleep() {
+            // stop the systick counter. It continues from the same 
+            // value when it is enabled again
+            SysTick->CTRL = SysTick->CTRL & ~SysTick_CTRL_ENABLE_Msk;
+
+            // a pending interrupt still wakes us up while the 
+            // interrupts are disabled
+            __WFI();
+
+            SysTick->CTRL = SysTick->CTRL | SysTick_CTRL_ENABLE_Msk;
+        }
+
+        /**
+         * @brief Returns if we are in the idle mode. Stays true 
+         * until the display is awake again
+         * 
+         * @return true 
+         * @return false 
+         */
+        static bool is_active() {
+            return active;
+        }
+
+        /**
+         * @brief Returns if we are waking up the display
+         * 
+         * @return true 
+         * @return false 
+         */
+        static bool is_waking() {
+            return waking;
+        }
+
+        /**
+         * @brief Returns the time until the next step of the wake 
+         * up
+         * 
+         * @return klib::time::us 
+         */
+        static klib::time::us remaining() {
+            if (!waking) {
+                return {};
+            }
+
+            return left(woken ? wake_delay : sleep_delay);
+        }
+    };
+
+    /**
+     * @brief Usb wake source for the idle mode. A usb interrupt 
+     * while we sleep (bus resume, a request of the host) only wakes
+     * the display when the host sends a start of frame after it. A
+     * host that suspends the bus also interrupts us but stops 
+     * sending frames
+     * 
+     * @tparam UsbPeriph 
+     * @tparam Irq interrupt of the usb 
+     */
+    template <typename UsbPeriph, IRQn_Type Irq>
+    class usb_wake {
+    protected:
+        // start of frame flag in the device interrupt status. Set 
+        // on every frame even when the interrupt is not enabled
+        constexpr static uint32_t frame_flag = 0x1;
+
+        // time we wait for a start of frame after the interrupt. 
+        // The host sends one every millisecond
+        constexpr static klib::time::us frame_timeout = 3'000;
+
+        // flag if we are waiting for a start of frame and the time
+        // we started waiting
+        static inline bool checking = false;
+        static inline klib::time::us start = {};
+
+        /**
+         * @brief Get the current runtime
+         * 
+         * @return klib::time::us 
+         */
+        static klib::time::us now() {
+            return klib::io::systick<>::template get_runtime<klib::time::us>();
+        }
+
+    public:
+        /**
+         * @brief Check if the usb woke us up. Should be called after
+         * the sleep while the interrupts are still disabled
+         * 
+         */
+        static void woken() {
+            if (!NVIC_GetPendingIRQ(Irq)) {
+                return;
+            }
+
+            // only count the frames after the interrupt
+            UsbPeriph::port->DEVINTCLR = frame_flag;
+
+            checking = true;
+            start = now();
+        }
+
+        /**
+         * @brief Returns if the host sent a start of frame after the
+         * usb woke us up. Should be called from the main loop
+         * 
+         * @return true when the display should wake up 
+         * @return false 
+         */
+        static bool update() {
+            if (!checking) {
+                return false;
+            }
+
+            if (UsbPeriph::port->DEVINTST & frame_flag) {
+                checking = false;
+
+                return true;
+            }
+
+            // no frames. The host suspended the bus
+            if ((now() - start) >= frame_timeout) {
+                checking = false;
+            }
+
+            return false;
+        }
+
+        /**
+         * @brief Stop waiting for a start of frame
+         * 
+         */
+        static void stop() {
+            checking = false;
+        }
+
+        /**
+         * @brief Returns if we are waiting for a start of frame
+         * 
+         * @return true 
+         * @return false 
+         */
+        static bool is_checking() {
+            return checking;
+        }
+    };
+}
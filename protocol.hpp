@@ -0,0 +1,444 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <algorithm>
+
+#include <klib/units.hpp>
+
+#include "storage.hpp"
+#include "drift.hpp"
+#include "spsc.hpp"
+#include "crc.hpp"
+
+namespace protocol {
+    /**
+     * @brief Commands of the protocol
+     * 
+     */
+    enum class command: uint8_t {
+        // get the version of the protocol and the amount of profiles
+        info = 0x01,
+
+        // get a profile without the key
+        list = 0x02,
+
+        // start a new transaction
+        begin = 0x03,
+
+        // add a profile in the current transaction
+        add = 0x04,
+
+        // remove a profile in the current transaction
+        remove = 0x05,
+
+        // write the current transaction to flash
+        commit = 0x06,
+
+        // set the rtc time (utc)
+        set_time = 0x07,
+    };
+
+    /**
+     * @brief Result of a command
+     * 
+     */
+    enum class status: uint8_t {
+        ok = 0x00,
+        invalid_crc = 0x01,
+        invalid_command = 0x02,
+        invalid_argument = 0x03,
+        full = 0x04,
+        not_found = 0x05,
+    };
+
+    // markers at the start of a request and a response
+    constexpr static uint8_t request_sync = 0xa5;
+    constexpr static uint8_t response_sync = 0x5a;
+
+    // version of the protocol
+    constexpr static uint8_t version = 1;
+
+    // max amount of payload in a single frame
+    constexpr static uint32_t max_payload = 64;
+
+    /**
+     * @brief Command channel to manage the profiles without the
+     * filesystem. Does not depend on the transport. The transport
+     * pushes the received bytes (can be done from a interrupt) and
+     * the main loop handles the commands. Responses are written
+     * using Transport::write(const uint8_t* data, uint32_t size)
+     * 
+     * Request: sync, command, length, payload, crc32
+     * Response: sync, command, status, length, payload, crc32
+     * 
+     * The crc32 is little endian and covers everything between
+     * the sync byte and the crc
+     * 
+     * @tparam Storage 
+     * @tparam Rtc 
+     * @tparam RtcPeriph 
+     * @tparam Transport 
+     */
+    template <typename Storage, typename Rtc, typename RtcPeriph, typename Transport>
+    class handler {
+    protected:
+        /**
+         * @brief States of the frame parser
+         * 
+         */
+        enum class state {
+            sync,
+            command,
+            length,
+            payload,
+            crc
+        };
+
+        // bytes received by the transport
+        static inline spsc::queue<uint8_t, 256> received;
+
+        // current state of the parser
+        static inline state current = state::sync;
+
+        // request we are receiving (command, length and payload)
+        static inline std::array<uint8_t, max_payload + 2> request = {};
+
+        // amount of payload and crc bytes we have received
+        static inline uint32_t position = 0;
+
+        // crc of the request
+        static inline uint32_t request_crc = 0;
+
+        /**
+         * @brief Read a little endian value from a buffer
+         * 
+         * @tparam T 
+         * @param data 
+         * @return T 
+         */
+        template <typename T>
+        static T read(const uint8_t *const data) {
+            T ret = 0;
+
+            for (uint32_t i = 0; i < sizeof(T); i++) {
+                ret |= static_cast<T>(data[i]) << (i * 8);
+            }
+
+            return ret;
+        }
+
+        /**
+         * @brief Write a little endian value to a buffer
+         * 
+         * @tparam T 
+         * @param data 
+         * @param value 
+         */
+        template <typename T>
+        static void write(uint8_t *const data, const T value) {
+            for (uint32_t i = 0; i < sizeof(T); i++) {
+                data[i] = static_cast<uint8_t>(value >> (i * 8));
+            }
+        }
+
+        /**
+         * @brief Send a response to the host
+         * 
+         * @param cmd 
+         * @param result 
+         * @param payload 
+         * @param size 
+         */
+        static void respond(const uint8_t cmd, const status result, const uint8_t *const payload = nullptr, const uint8_t size = 0) {
+            std::array<uint8_t, max_payload + 8> response;
+
+            response[0] = response_sync;
+            response[1] = cmd;
+            response[2] = static_cast<uint8_t>(result);
+            response[3] = size;
+
+            if (size) {
+                std::copy_n(payload, size, response.begin() + 4);
+            }
+
+            // add the crc over everything after the sync byte
+            write<uint32_t>(&response[4 + size], crc::crc32(&response[1], size + 3));
+
+            Transport::write(response.data(), size + 8);
+        }
+
+        /**
+         * @brief Send the version and the amount of profiles
+         * 
+         * @param cmd 
+         */
+        static void info(const uint8_t cmd) {
+            // version, amount of profiles and the max amount of 
+            // profiles
+            uint8_t data[5] = {version};
+            write<uint16_t>(&data[1], Storage::size());
+            write<uint16_t>(&data[3], Storage::max_entries);
+
+            respond(cmd, status::ok, data, sizeof(data));
+        }
+
+        /**
+         * @brief Send a single profile. The key is never sent to 
+         * the host
+         * 
+         * @param cmd 
+         * @param payload 
+         * @param size 
+         */
+        static void list(const uint8_t cmd, const uint8_t *const payload, const uint8_t size) {
+            if (size != sizeof(uint16_t)) {
+                return respond(cmd, status::invalid_argument);
+            }
+
+            // use the same snapshot for the check and the entry
+            const auto& entries = Storage::pin();
+            const uint16_t index = read<uint16_t>(payload);
+
+            if (index >= entries.size()) {
+                return respond(cmd, status::not_found);
+            }
+
+            const auto& e = entries.get(index);
+
+            // name, digits and interval
+            uint8_t data[sizeof(e.str) + 2] = {};
+            std::copy_n(e.str, sizeof(e.str), data);
+            data[sizeof(e.str)] = static_cast<uint8_t>(e.digits);
+            data[sizeof(e.str) + 1] = e.interval;
+
+            respond(cmd, status::ok, data, sizeof(data));
+        }
+
+        /**
+         * @brief Add a profile to the current transaction. The 
+         * payload has the name, digits, interval, the key length 
+         * and the key
+         * 
+         * @param cmd 
+         * @param payload 
+         * @param size 
+         */
+        static void add(const uint8_t cmd, const uint8_t *const payload, const uint8_t size) {
+            storage::entry e = {};
+
+            // size of everything before the key
+            constexpr static uint32_t header = sizeof(e.str) + 3;
+
+            if ((size < header) || (payload[header - 1] != (size - header)) ||
+                ((size - header) > e.key.max_size()))
+            {
+                return respond(cmd, status::invalid_argument);
+            }
+
+            std::copy_n(payload, sizeof(e.str), e.str);
+            e.str[sizeof(e.str) - 1] = 0x00;
+            e.digits = static_cast<storage::digit>(payload[sizeof(e.str)]);
+            e.interval = payload[sizeof(e.str) + 1];
+
+            // use the same limits as the config file
+            if (!storage::is_valid(e.digits) || !e.interval || (e.interval > 180) || !e.str[0]) {
+                return respond(cmd, status::invalid_argument);
+            }
+
+            for (uint32_t i = header; i < size; i++) {
+                e.key.push_back(static_cast<char>(payload[i]));
+            }
+
+            respond(cmd, Storage::add(e) ? status::ok : status::full);
+        }
+
+        /**
+         * @brief Remove a committed profile in the current 
+         * transaction
+         * 
+         * @param cmd 
+         * @param payload 
+         * @param size 
+         */
+        static void remove(const uint8_t cmd, const uint8_t *const payload, const uint8_t size) {
+            if (size != sizeof(uint16_t)) {
+                return respond(cmd, status::invalid_argument);
+            }
+
+            const uint16_t index = read<uint16_t>(payload);
+
+            if (index >= Storage::size()) {
+                return respond(cmd, status::not_found);
+            }
+
+            Storage::remove(index);
+
+            respond(cmd, status::ok);
+        }
+
+        /**
+         * @brief Set the rtc to a utc epoch. The time of the host is
+         * used as a sample of the drift of the rtc
+         * 
+         * @param cmd 
+         * @param payload 
+         * @param size 
+         */
+        static void set_time(const uint8_t cmd, const uint8_t *const payload, const uint8_t size) {
+            if (size != sizeof(uint32_t)) {
+                return respond(cmd, status::invalid_argument);
+            }
+
+            // get the time of the rtc before we change it
+            const auto previous = Rtc::get();
+            const auto epoch = klib::time::s(read<uint32_t>(payload));
+
+            Rtc::set(epoch);
+
+            // the host sends the time it has synced. Use the 
+            // difference as a sample of the drift of the rtc
+            drift::history<RtcPeriph>::record(previous.value, epoch.value);
+
+            respond(cmd, status::ok);
+        }
+
+        /**
+         * @brief Handle a complete request
+         * 
+         * @param cmd 
+         * @param payload 
+         * @param size 
+         */
+        static void execute(const uint8_t cmd, const uint8_t *const payload, const uint8_t size) {
+            switch (static_cast<command>(cmd)) {
+                case command::info:
+                    info(cmd);
+                    break;
+                case command::list:
+                    list(cmd, payload, size);
+                    break;
+                case command::begin:
+                    Storage::begin();
+                    respond(cmd, status::ok);
+                    break;
+                case command::add:
+                    add(cmd, payload, size);
+                    break;
+                case command::remove:
+                    remove(cmd, payload, size);
+                    break;
+                case command::commit:
+                    Storage::commit();
+                    respond(cmd, status::ok);
+                    break;
+                case command::set_time:
+                    set_time(cmd, payload, size);
+                    break;
+                default:
+                    respond(cmd, status::invalid_command);
+                    break;
+            }
+        }
+
+        /**
+         * @brief Run a single byte through the frame parser
+         * 
+         * @param data 
+         * @return true when a request was handled 
+         * @return false 
+         */
+        static bool parse(const uint8_t data) {
+            switch (current) {
+                case state::sync:
+                    // skip everything until we have a sync byte
+                    if (data == request_sync) {
+                        current = state::command;
+                    }
+                    break;
+                case state::command:
+                    request[0] = data;
+                    current = state::length;
+                    break;
+                case state::length:
+                    request[1] = data;
+                    position = 0;
+                    request_crc = 0;
+
+                    // drop frames that do not fit
+                    if (data > max_payload) {
+                        current = state::sync;
+                    }
+                    else {
+                        current = (data ? state::payload : state::crc);
+                    }
+                    break;
+                case state::payload:
+                    request[2 + position] = data;
+                    position++;
+
+                    if (position == request[1]) {
+                        position = 0;
+                        current = state::crc;
+                    }
+                    break;
+                case state::crc:
+                    request_crc |= static_cast<uint32_t>(data) << (position * 8);
+                    position++;
+
+                    if (position < sizeof(uint32_t)) {
+                        break;
+                    }
+
+                    current = state::sync;
+
+                    // check the request is not corrupted
+                    if (request_crc != crc::crc32(request.data(), request[1] + 2)) {
+                        respond(request[0], status::invalid_crc);
+                    }
+                    else {
+                        execute(request[0], &request[2], request[1]);
+                    }
+
+                    return true;
+            }
+
+            return false;
+        }
+
+    public:
+        /**
+         * @brief Add a received byte. Should only be called by the
+         * transport. Returns false when the byte is dropped
+         * 
+         * @param data 
+         * @return true 
+         * @return false 
+         */
+        static bool push(const uint8_t data) {
+            return received.push(data);
+        }
+
+        /**
+         * @brief Handle the received bytes until a single request is
+         * done. Should be called from the main loop
+         * 
+         * @return true when there might be more work 
+         * @return false 
+         */
+        static bool update() {
+            while (!received.empty()) {
+                const uint8_t data = received.front();
+                received.pop();
+
+                // stop after a request to keep the main loop
+                // responsive
+                if (parse(data)) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+    };
+}
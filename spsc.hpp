@@ -0,0 +1,119 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace spsc {
+    /**
+     * @brief Wait-free queue between a single producer and a single
+     * consumer (for example a interrupt and the main loop). The
+     * producer only writes the tail and the consumer only writes
+     * the head, so no side has to disable the interrupts
+     * 
+     * @tparam T 
+     * @tparam Size 
+     */
+    template <typename T, uint32_t Size>
+    class queue {
+    protected:
+        // the indices are free running. Using a power of 2 keeps
+        // the mapping to the buffer correct when they wrap around
+        static_assert((Size & (Size - 1)) == 0, "Size should be a power of 2");
+
+        // storage for all the items
+        std::array<T, Size> items = {};
+
+        // index of the next item the consumer reads
+        std::atomic<uint32_t> head = 0;
+
+        // index of the next item the producer writes
+        std::atomic<uint32_t> tail = 0;
+
+    public:
+        /**
+         * @brief Add a item to the queue. Should only be called
+         * by the producer
+         * 
+         * @param item 
+         * @return true when the item is added 
+         * @return false when the queue is full 
+         */
+        bool push(const T& item) {
+            const uint32_t t = tail.load(std::memory_order_relaxed);
+
+            // check if we have space for the item
+            if ((t - head.load(std::memory_order_acquire)) >= Size) {
+                return false;
+            }
+
+            items[t % Size] = item;
+
+            // publish the item to the consumer
+            tail.store(t + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        /**
+         * @brief Get the oldest item in the queue. Should only be
+         * called by the consumer when the queue is not empty
+         * 
+         * @return const T& 
+         */
+        const T& front() const {
+            return items[head.load(std::memory_order_relaxed) % Size];
+        }
+
+        /**
+         * @brief Remove the oldest item from the queue. Should only
+         * be called by the consumer
+         * 
+         * @return true when a item is removed 
+         * @return false when the queue is empty 
+         */
+        bool pop() {
+            const uint32_t h = head.load(std::memory_order_relaxed);
+
+            // check if we have a item
+            if (h == tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            // give the slot back to the producer
+            head.store(h + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        /**
+         * @brief Returns if the queue has no items. Can be called
+         * from both sides
+         * 
+         * @return true 
+         * @return false 
+         */
+        bool empty() const {
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+        }
+
+        /**
+         * @brief Returns the amount of items in the queue. Can be
+         * called from both sides
+         * 
+         * @return uint32_t 
+         */
+        uint32_t size() const {
+            return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+        }
+
+        /**
+         * @brief Remove all the items from the queue. Should only
+         * be called by the consumer
+         * 
+         */
+        void clear() {
+            head.store(tail.load(std::memory_order_acquire), std::memory_order_release);
+        }
+    };
+}
@@ -1,10 +1,17 @@
 #pragma once
 
 #include <span>
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <algorithm>
 
 #include <klib/dynamic_array.hpp>
 #include <klib/string.hpp>
+#include <klib/math.hpp>
+
+#include "hmac.hpp"
+#include "crc.hpp"
 
 extern "C" {
     // Start of the profile section. Definition is done in the 
@@ -62,89 +69,995 @@ namespace storage {
     static_assert(sizeof(entry) == 64, "Invalid size");
 
     /**
-     * @brief Storage class that reads the entries
+     * @brief Storage class that reads the entries. The entries are
+     * read in place from flash. Only the midstates of the keys we 
+     * are using are cached in ram
+     * 
+     * The entries are stored in a append only log in one of the 
+     * two halves (banks) of the profile sector. Every flash page has 
+     * up to 3 new entries and a trailer with the entries it removes.
+     * All the pages of a transaction have the same sequence number.
+     * Only the last page is marked as committed. Pages of a 
+     * transaction that was never committed are ignored
+     * 
+     * When the bank is full the live entries are compacted into the
+     * other bank. The header of the new bank is written last. On 
+     * startup the valid bank with the highest generation is used
+     * 
+     * The flash can only erase the whole sector. When the other bank
+     * is still erased the compaction copies the entries directly. 
+     * Otherwise the live entries are copied to the ram we get from 
+     * Staging (static std::span<uint8_t> get(), at least 
+     * staging_size bytes) before the sector is erased. A power loss 
+     * between the erase and the header of the new bank loses the 
+     * entries. This happens on every second compaction
+     * 
+     * Readers use a snapshot of the committed entries. The writer 
+     * fills the snapshot that is not published and swaps them by 
+     * updating the version. A reader never sees a half updated 
+     * table and does not block the writer
      * 
      */
-    template <typename Flash>
+    template <typename Flash, typename Staging>
     class storage {
     public:
-        // the max amount of entries we support for now
-        constexpr static uint32_t max_entries = 32;
+        // the max amount of entries we support. A bank has room for
+        // 189 entries. The rest is kept free for the pages of the 
+        // tombstones and of a transaction after a compaction
+        constexpr static uint32_t max_entries = 160;
+
+        // amount of ram needed to hold the entries while the sector 
+        // is erased
+        constexpr static uint32_t staging_size = max_entries * sizeof(entry);
+
+        /**
+         * @brief Consistent view of the committed entries. Stays 
+         * valid until the writer publishes two new snapshots. A 
+         * snapshot should only be used for a short time (e.g. a 
+         * single draw or a single usb read)
+         * 
+         */
+        struct snapshot {
+            // address of the bank with the entries
+            uint32_t address;
+
+            // amount of entries in the snapshot
+            uint32_t count;
+
+            // slots of the entries in the bank
+            std::array<uint16_t, max_entries> slots;
+
+            /**
+             * @brief Get the amount of entries in the snapshot
+             * 
+             * @return uint32_t 
+             */
+            uint32_t size() const {
+                return count;
+            }
+
+            /**
+             * @brief Get a entry. The entry is read directly from 
+             * flash
+             * 
+             * @param index 
+             * @return const entry& 
+             */
+            const entry& get(const uint32_t index) const {
+                // the slot has the page and the entry in the page
+                return *reinterpret_cast<const entry*>(
+                    address + ((slots[index] / entries_per_page) * page_size) + 
+                    ((slots[index] % entries_per_page) * sizeof(entry))
+                );
+            }
+        };
 
     protected:
-        // array to store all the entries
-        static inline klib::dynamic_array<entry, max_entries> entries = {};
+        // size of the flash sector with the profiles. The flash 
+        // erases the whole sector at once
+        constexpr static uint32_t sector_size = 32 * 1024;
+
+        // amount of banks in the sector and the size of a bank
+        constexpr static uint32_t bank_count = 2;
+        constexpr static uint32_t bank_size = sector_size / bank_count;
+
+        // size of a single write to flash
+        constexpr static uint32_t page_size = 256;
+
+        // amount of pages in a bank. The first page has the bank 
+        // header
+        constexpr static uint32_t pages_per_bank = bank_size / page_size;
+
+        // amount of entries in a single flash page. The last 
+        // entry slot is used for the trailer
+        constexpr static uint32_t entries_per_page = (page_size / sizeof(entry)) - 1;
+
+        // amount of entries a single page can remove. The trailer 
+        // with the tombstones takes the place of the last entry
+        constexpr static uint32_t tombstones_per_page = 24;
+
+        // markers for a programmed bank header and page
+        constexpr static uint32_t header_magic = 0x544f5450;
+        constexpr static uint32_t page_magic = 0x50414745;
+
+        // marker for erased flash
+        constexpr static uint32_t erased = 0xffffffff;
+
+        // a compacted bank with all the entries should still have 
+        // room for the pages of a commit that removes all of them. 
+        // The committed and the new entries can both end in a page
+        // that is not full
+        static_assert(
+            1 + ((max_entries / entries_per_page) + 2) + 
+            (1 + (max_entries / tombstones_per_page)) <= pages_per_bank, 
+            "Not enough space in a bank for the max amount of entries"
+        );
+
+        // flag set on the last page of a transaction
+        constexpr static uint8_t flag_commit = 0x01;
+
+        /**
+         * @brief Header in the first page of every bank
+         * 
+         */
+        struct bank_header {
+            // marker the header is valid
+            uint32_t magic;
+
+            // incremented every time we compact into the other bank. 
+            // The bank with the highest generation has the entries
+            uint32_t generation;
+
+            // amount of times the sector was erased
+            uint32_t erase_count;
+
+            // padding to fill the page
+            uint8_t padding[page_size - (sizeof(uint32_t) * 4)];
+
+            // crc of all the fields above
+            uint32_t crc;
+        };
+
+        static_assert(sizeof(bank_header) == page_size, "Invalid size");
+
+        /**
+         * @brief Trailer after the entries in every page
+         * 
+         */
+        struct page_trailer {
+            // marker the page is programmed
+            uint32_t magic;
+
+            // amount of new entries in this page
+            uint8_t entries;
+
+            // amount of entries this page removes
+            uint8_t tombstones;
+
+            // flags of the page (flag_commit)
+            uint8_t flags;
+
+            // padding
+            uint8_t padding;
+
+            // sequence number of the transaction the page is part of
+            uint32_t sequence;
+
+            // slots of the entries this page removes
+            std::array<uint16_t, tombstones_per_page> removed;
+
+            // crc of the whole page except the crc
+            uint32_t crc;
+        };
+
+        static_assert(sizeof(page_trailer) == sizeof(entry), "Invalid size");
+
+        /**
+         * @brief A single page in the log
+         * 
+         */
+        struct page_t {
+            // new entries in this page
+            std::array<entry, entries_per_page> entries;
+
+            // trailer with the information about the page
+            page_trailer trailer;
+        };
+
+        static_assert(sizeof(page_t) == page_size, "Invalid size");
+
+        // amount of midstates we cache. Should cover the profiles
+        // around the current profile
+        constexpr static uint32_t midstate_slots = 16;
+
+        // marker for a midstate slot without data
+        constexpr static uint32_t invalid_index = 0xffffffff;
+
+        /**
+         * @brief Cached midstate of a entry
+         * 
+         */
+        struct cached_midstate {
+            // index of the entry the midstate belongs to and the 
+            // version of the snapshot the index is from
+            uint32_t index;
+            uint32_t version;
+
+            // midstate of the key of the entry
+            hmac::midstate state;
+        };
+
+        // slots of all the live entries in the active bank
+        static inline klib::dynamic_array<uint16_t, max_entries> index = {};
+
+        // hmac midstates of the keys of the last used entries
+        static inline std::array<cached_midstate, midstate_slots> midstates = {};
+
+        // snapshots for the readers. The writer only changes the 
+        // snapshot that is not published
+        static inline std::array<snapshot, 2> snapshots = {};
+
+        // version of the published snapshot. The published snapshot
+        // is at (version & 1)
+        static inline std::atomic<uint32_t> version = 0;
+
+        // start address of the profile region
+        static inline uint32_t start_address = erased;
+
+        // bank with the entries and the header of the bank
+        static inline uint32_t active = 0;
+        static inline bank_header header = {};
+
+        // next page in the active bank we can write to
+        static inline uint32_t next_page = 0;
+
+        // sequence number of the current transaction
+        static inline uint32_t sequence = 0;
+
+        // amount of entries that are committed. Entries added in a
+        // transaction are after these and are only visible after
+        // the commit
+        static inline uint32_t committed = 0;
+
+        // entries that should be removed in the next commit
+        static inline std::array<uint32_t, max_entries / 32> removed = {};
+
+        // page we are filling before it is written to flash
+        static inline page_t page = {};
+
+        /**
+         * @brief Get the address of a bank
+         * 
+         * @param bank 
+         * @return uint32_t 
+         */
+        static uint32_t bank_address(const uint32_t bank) {
+            return start_address + (bank * bank_size);
+        }
+
+        /**
+         * @brief Get a page in a bank
+         * 
+         * @param bank 
+         * @param index 
+         * @return const page_t& 
+         */
+        static const page_t& get_page(const uint32_t bank, const uint32_t index) {
+            return *reinterpret_cast<const page_t*>(bank_address(bank) + (index * page_size));
+        }
+
+        /**
+         * @brief Get a page in the active bank
+         * 
+         * @param index 
+         * @return const page_t& 
+         */
+        static const page_t& get_page(const uint32_t index) {
+            return get_page(active, index);
+        }
+
+        /**
+         * @brief Calculate the crc of a page or header. The crc is
+         * stored in the last 4 bytes and is not included
+         * 
+         * @param data 
+         * @return uint32_t 
+         */
+        static uint32_t page_crc(const void* data) {
+            return crc::crc32(reinterpret_cast<const uint8_t*>(data), page_size - sizeof(uint32_t));
+        }
+
+        /**
+         * @brief Returns if a page is still erased
+         * 
+         * @param data 
+         * @return true 
+         * @return false 
+         */
+        static bool is_erased(const void* data) {
+            const uint32_t* ptr = reinterpret_cast<const uint32_t*>(data);
+
+            for (uint32_t i = 0; i < (page_size / sizeof(uint32_t)); i++) {
+                if (ptr[i] != erased) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        /**
+         * @brief Returns if all the pages of a bank are still erased
+         * 
+         * @param bank 
+         * @return true 
+         * @return false 
+         */
+        static bool is_erased_bank(const uint32_t bank) {
+            for (uint32_t i = 0; i < pages_per_bank; i++) {
+                if (!is_erased(&get_page(bank, i))) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        /**
+         * @brief Returns if a page is written completely
+         * 
+         * @param p 
+         * @return true 
+         * @return false 
+         */
+        static bool is_valid_page(const page_t& p) {
+            return (p.trailer.magic == page_magic) && 
+                (p.trailer.entries <= entries_per_page) &&
+                (p.trailer.tombstones <= tombstones_per_page) &&
+                (p.trailer.crc == page_crc(&p));
+        }
+
+        /**
+         * @brief Write a page to flash
+         * 
+         * @param address 
+         * @param data 
+         */
+        static void write_page(const uint32_t address, const void* data) {
+            const std::span<const uint8_t> p = {
+                reinterpret_cast<const uint8_t*>(data), page_size
+            };
+
+            // write the new data
+            Flash::write(address, p);
+        }
+
+        /**
+         * @brief Write a page buffer to flash. Adds the trailer 
+         * information
+         * 
+         * @param address 
+         * @param p 
+         * @param flags 
+         */
+        static void write_page(const uint32_t address, page_t& p, const uint8_t flags) {
+            p.trailer.magic = page_magic;
+            p.trailer.flags = flags;
+            p.trailer.sequence = sequence;
+            p.trailer.crc = page_crc(&p);
+
+            write_page(address, &p);
+        }
+
+        /**
+         * @brief Clear a page buffer. Erased flash is all 0xff
+         * 
+         * @param p 
+         */
+        static void clear_page(page_t& p) {
+            std::fill_n(reinterpret_cast<uint8_t*>(&p), page_size, 0xff);
+
+            p.trailer.entries = 0;
+            p.trailer.tombstones = 0;
+            p.trailer.padding = 0;
+        }
+
+        /**
+         * @brief Returns if a entry in flash is valid
+         * 
+         * @param e 
+         * @return true 
+         * @return false 
+         */
+        static bool is_valid_entry(const entry& e) {
+            // check for a empty string (all 0xff) or invalid data
+            return !(
+                static_cast<uint8_t>(e.str[0]) == 0xff || !is_valid(e.digits) || 
+                !e.interval
+            );
+        }
+
+        /**
+         * @brief Clear all the cached midstates
+         * 
+         */
+        static void clear_midstates() {
+            for (auto& m: midstates) {
+                m.index = invalid_index;
+            }
+        }
+
+        /**
+         * @brief Copy the committed entries into the snapshot that 
+         * is not used and make it the published snapshot
+         * 
+         */
+        static void publish() {
+            const uint32_t v = version.load(std::memory_order_relaxed);
+
+            // fill the snapshot the readers are not using
+            auto& s = snapshots[(v + 1) & 1];
+
+            s.address = bank_address(active);
+            s.count = committed;
+            std::copy_n(index.begin(), committed, s.slots.begin());
+
+            // swap the snapshots
+            version.store(v + 1, std::memory_order_release);
+        }
+
+        /**
+         * @brief Remove a slot from the index
+         * 
+         * @param slot 
+         */
+        static void remove_slot(const uint16_t slot) {
+            for (uint32_t i = 0; i < index.size(); i++) {
+                if (index[i] == slot) {
+                    // move everything after it one place forward
+                    for (uint32_t j = i + 1; j < index.size(); j++) {
+                        index[j - 1] = index[j];
+                    }
+
+                    index.pop_back();
+
+                    return;
+                }
+            }
+        }
+
+        /**
+         * @brief Copy entries into a erased bank and write the 
+         * header of the bank. The header is written last. A bank
+         * without a valid header is ignored on startup
+         * 
+         * The committed entries are written as committed pages. The
+         * entries of the current transaction are written without 
+         * the commit flag. These become valid when the transaction
+         * is committed
+         * 
+         * @param bank 
+         * @param source 
+         */
+        template <typename T>
+        static void copy_into(const uint32_t bank, const T& source) {
+            // get the erase counter and generation from the current 
+            // header
+            bank_header h = header;
+
+            page_t buf;
+            clear_page(buf);
+
+            uint32_t p = 1;
+
+            // copy all the entries into the new bank
+            for (uint32_t i = 0; i < index.size(); i++) {
+                buf.entries[buf.trailer.entries] = source(i);
+
+                // the entry moves to the new slot
+                index[i] = (p * entries_per_page) + buf.trailer.entries;
+                buf.trailer.entries++;
+
+                // check if we need to write the page. The last page of 
+                // the committed entries is written on its own
+                if ((buf.trailer.entries == entries_per_page) || ((i + 1) == committed)) {
+                    // every page with committed entries is its own 
+                    // committed transaction
+                    write_page(
+                        bank_address(bank) + (p * page_size), buf, 
+                        (i < committed) ? flag_commit : 0x00
+                    );
+
+                    clear_page(buf);
+                    p++;
+                }
+            }
+
+            // write the last page if we have any entries left
+            if (buf.trailer.entries) {
+                write_page(bank_address(bank) + (p * page_size), buf, 0x00);
+
+                p++;
+            }
+
+            // write the header to mark the bank as valid
+            h.magic = header_magic;
+            h.generation = (header.magic == header_magic) ? (header.generation + 1) : 0;
+            h.crc = page_crc(&h);
 
-        // start address used in writing
-        static inline uint32_t start_address = 0xffffffff;
+            write_page(bank_address(bank), &h);
+
+            // switch to the new bank
+            active = bank;
+            header = h;
+            next_page = p;
+
+            // the committed entries moved. The old bank is only 
+            // erased on the next compaction so readers of the old 
+            // snapshot can still use it
+            publish();
+        }
+
+        /**
+         * @brief Move the entries we get from the source into the 
+         * other bank. Erases the sector first when the other bank 
+         * is in use
+         * 
+         * @param source 
+         */
+        template <typename T>
+        static void relocate(const T& source) {
+            const uint32_t target = (active + 1) % bank_count;
+
+            // the other bank is still erased after the last erase. 
+            // The entries can be copied directly
+            if (is_erased_bank(target)) {
+                copy_into(target, source);
+
+                return;
+            }
+
+            // both banks are in use. Copy the entries to ram as the 
+            // erase removes the entries in both banks
+            entry *const staged = reinterpret_cast<entry*>(Staging::get().data());
+
+            for (uint32_t i = 0; i < index.size(); i++) {
+                staged[i] = source(i);
+            }
+
+            Flash::erase(Flash::erase_mode::sector, start_address);
+            header.erase_count++;
+
+            copy_into(target, [staged](const uint32_t i) -> const entry& {
+                return staged[i];
+            });
+        }
+
+        /**
+         * @brief Move the live entries to the other bank
+         * 
+         */
+        static void compact() {
+            const uint32_t source = active;
+
+            relocate([source](const uint32_t i) -> const entry& {
+                return *reinterpret_cast<const entry*>(
+                    bank_address(source) + 
+                    ((index[i] / entries_per_page) * page_size) + 
+                    ((index[i] % entries_per_page) * sizeof(entry))
+                );
+            });
+        }
+
+        /**
+         * @brief Write the page buffer at the end of the log. 
+         * Compacts the log first when the bank is full
+         * 
+         * @param flags 
+         */
+        static void flush_page(const uint8_t flags) {
+            // check if we have space left in the bank
+            if (next_page >= pages_per_bank) {
+                compact();
+            }
+
+            write_page(bank_address(active) + (next_page * page_size), page, flags);
+
+            // add the new entries to the index
+            for (uint32_t i = 0; i < page.trailer.entries; i++) {
+                index.push_back((next_page * entries_per_page) + i);
+            }
+
+            next_page++;
+
+            clear_page(page);
+        }
+
+        /**
+         * @brief Returns if a entry is marked to be removed
+         * 
+         * @param index 
+         * @return true 
+         * @return false 
+         */
+        static bool is_removed(const uint32_t index) {
+            return removed[index / 32] & (0x1 << (index % 32));
+        }
+
+        /**
+         * @brief Import the entries of the old storage format. These 
+         * are stored without header at the start of the sector
+         * 
+         */
+        static void import() {
+            // header of the legacy format. The sector was never 
+            // erased by us
+            header = {};
+            header.magic = erased;
+
+            // the entries are in the first bank
+            active = 0;
+
+            // count the entries stored at the start of the sector
+            const entry* entries = reinterpret_cast<const entry*>(
+                bank_address(0)
+            );
+
+            for (uint32_t i = 0; i < max_entries; i++) {
+                // TODO: decrypt the keys here
+                if (!is_valid_entry(entries[i])) {
+                    break;
+                }
+
+                index.push_back(i);
+            }
+
+            // all the entries we found are committed
+            committed = index.size();
+
+            // copy them to the second bank in the new format. The 
+            // old firmware only used the start of the sector
+            relocate([entries](const uint32_t i) -> const entry& {
+                return entries[i];
+            });
+        }
+
+        /**
+         * @brief Apply the changes of a page to the index
+         * 
+         * @param page 
+         */
+        static void apply(const uint32_t page) {
+            const auto& p = get_page(page);
+
+            // add all the new entries
+            for (uint32_t i = 0; i < p.trailer.entries; i++) {
+                if (index.size() < index.max_size()) {
+                    index.push_back((page * entries_per_page) + i);
+                }
+            }
+
+            // remove all the entries the page removes
+            for (uint32_t i = 0; i < p.trailer.tombstones; i++) {
+                remove_slot(p.trailer.removed[i]);
+            }
+        }
+
+        /**
+         * @brief Replay the log of the active bank to get the 
+         * live entries. Only committed transactions are used
+         * 
+         */
+        static void replay() {
+            index.clear();
+
+            // search for the first page we can write to. A page that
+            // is partially written can not be used anymore
+            next_page = pages_per_bank;
+
+            while ((next_page > 1) && is_erased(&get_page(next_page - 1))) {
+                next_page--;
+            }
+
+            sequence = 0;
+
+            for (uint32_t start = 1; start < next_page;) {
+                // skip pages that are not written completely
+                if (!is_valid_page(get_page(start))) {
+                    start++;
+
+                    continue;
+                }
+
+                // search for the end of the transaction
+                const uint32_t s = get_page(start).trailer.sequence;
+                uint32_t end = start;
+
+                while (end < next_page) {
+                    const auto& p = get_page(end);
+
+                    // stop at the first page of a different transaction
+                    if (!is_valid_page(p) || (p.trailer.sequence != s)) {
+                        break;
+                    }
+
+                    end++;
+
+                    // stop after the page that commits the transaction
+                    if (p.trailer.flags & flag_commit) {
+                        break;
+                    }
+                }
+
+                // only use the transaction when it is committed
+                if (get_page(end - 1).trailer.flags & flag_commit) {
+                    for (uint32_t i = start; i < end; i++) {
+                        apply(i);
+                    }
+                }
+
+                // keep track of the highest sequence number
+                sequence = klib::max(sequence, s);
+
+                start = end;
+            }
+        }
 
     public:
         /**
-         * @brief Read the memory and add them to the entries array
+         * @brief Init the storage with the profile region
          * 
          * @param start 
          * @param end 
          * @param key 
          */
         static void init(const std::span<uint8_t> key, const uint32_t start, const uint32_t end) {
-            // update the start address and set the address we should
-            // start reading from
-            uint32_t address = start_address = start;
+            // make sure we have the whole sector
+            if ((end - start) < sector_size) {
+                return;
+            }
 
-            // get all the entries
-            for (uint32_t i = 0; (i < max_entries) && ((address + sizeof(entry)) < end); i++) {
-                // TODO: decrypt the keys here
-                const auto& e = *reinterpret_cast<const entry*>(address);
-
-                // check if the current entry is valid (we check for a empty 
-                // string or all 0xff)
-                if (e.str[0] == 0xff || !is_valid(e.digits) || 
-                    !e.interval)
-                {
-                    // we are at the end or we have a corrupt entry. Exit
-                    break;
+            // update the start address
+            start_address = start;
+
+            // search for the valid bank with the newest generation
+            bool found = false;
+
+            for (uint32_t i = 0; i < bank_count; i++) {
+                const auto& h = *reinterpret_cast<const bank_header*>(bank_address(i));
+
+                if ((h.magic != header_magic) || (h.crc != page_crc(&h))) {
+                    continue;
                 }
 
-                // copy to the local array
-                entries.push_back(e);
+                if (!found || (h.generation > header.generation)) {
+                    found = true;
+                    active = i;
+                    header = h;
+                }
+            }
+
+            // clear the state
+            clear_page(page);
+            removed = {};
+            clear_midstates();
+            index.clear();
 
-                // move to the next entry
-                address += sizeof(entry);
+            if (found) {
+                // get the entries from the log
+                replay();
             }
+            else {
+                // no bank is formatted yet
+                import();
+            }
+
+            committed = index.size();
+
+            // make the entries visible to the readers
+            publish();
+        }
+
+        /**
+         * @brief Get the published snapshot of the entries. Use the 
+         * same snapshot for all the reads that should be consistent
+         * 
+         * @return const snapshot& 
+         */
+        static const snapshot& pin() {
+            return snapshots[version.load(std::memory_order_acquire) & 1];
+        }
+
+        /**
+         * @brief Get the version of the published snapshot. Changes
+         * every time the entries change
+         * 
+         * @return uint32_t 
+         */
+        static uint32_t get_version() {
+            return version.load(std::memory_order_acquire);
+        }
+
+        /**
+         * @brief Get the snapshot of a version. Only valid for the 
+         * published version and the version before it
+         * 
+         * @param v 
+         * @return const snapshot& 
+         */
+        static const snapshot& pin(const uint32_t v) {
+            return snapshots[v & 1];
+        }
+
+        /**
+         * @brief Get the amount of entries we have stored
+         * 
+         * @return uint32_t 
+         */
+        static uint32_t size() {
+            return pin().size();
         }
 
         /**
-         * @brief Get all the entries we have stored
+         * @brief Get a entry. The entry is read directly from flash
          * 
-         * @return std::span<entry> 
+         * @param index 
+         * @return const entry& 
          */
-        static klib::dynamic_array<entry, max_entries>& get_entries() {
-            return entries;
+        static const entry& get(const uint32_t index) {
+            return pin().get(index);
         }
 
         /**
-         * @brief Writes the current entries to flash memory
+         * @brief Get the hmac midstates of a entry. Only calculates 
+         * the midstates when they are not in the cache
          * 
+         * @param index 
+         * @return const hmac::midstate& 
          */
-        static void write() {
+        static const hmac::midstate& get_midstate(const uint32_t index) {
+            auto& m = midstates[index % midstate_slots];
+
+            // get the snapshot the index belongs to
+            const uint32_t v = version.load(std::memory_order_acquire);
+
+            // check if we have the midstates of the entry
+            if ((m.index != index) || (m.version != v)) {
+                const auto& e = snapshots[v & 1].get(index);
+
+                m.state = hmac::precompute(
+                    reinterpret_cast<const uint8_t*>(e.key.data()), 
+                    e.key.size()
+                );
+
+                m.index = index;
+                m.version = v;
+            }
+
+            return m.state;
+        }
+
+        /**
+         * @brief Start a new transaction
+         * 
+         */
+        static void begin() {
+            // clear the transaction
+            removed = {};
+            clear_page(page);
+
+            // drop the entries of a transaction that was never 
+            // committed. These are ignored on startup
+            while (index.size() > committed) {
+                index.pop_back();
+            }
+
+            // use a new sequence number for the transaction
+            sequence++;
+        }
+
+        /**
+         * @brief Add a entry in the current transaction. Returns
+         * false if we do not have space for the entry
+         * 
+         * @param e 
+         * @return true 
+         * @return false 
+         */
+        static bool add(const entry& e) {
+            // check if we have space. Entries that are removed in 
+            // this transaction still count
+            if (start_address == erased || (index.size() + page.trailer.entries) >= max_entries) {
+                return false;
+            }
+
+            // add the entry to the page buffer
+            page.entries[page.trailer.entries] = e;
+            page.trailer.entries++;
+
+            // write the page to flash if it is full
+            if (page.trailer.entries == entries_per_page) {
+                flush_page(0x00);
+            }
+
+            return true;
+        }
+
+        /**
+         * @brief Remove a entry in the current transaction
+         * 
+         * @param index 
+         */
+        static void remove(const uint32_t index) {
+            removed[index / 32] |= (0x1 << (index % 32));
+        }
+
+        /**
+         * @brief Commit the current transaction to flash. New 
+         * entries are added at the end. The last page of the 
+         * transaction marks all the changes as valid at once
+         * 
+         */
+        static void commit() {
             // make sure we are initialized
-            if (start_address == 0xffffffff) {
-                // do not write if the start address is wrong
+            if (start_address == erased) {
                 return;
             }
 
-            // erase the sector
-            Flash::erase(Flash::erase_mode::sector, start_address);
+            // count the pages we need for the tombstones
+            uint32_t tombstones = 0;
 
-            // write in 1024 byte chunks
-            for (uint32_t i = 0; i < ((max_entries * sizeof(entry)) / 1024); i++) {
-                const std::span<const uint8_t> p = {
-                    (reinterpret_cast<const uint8_t*>(entries.data()) + i * 1024), 1024
-                };
+            for (uint32_t i = 0; i < committed; i++) {
+                tombstones += is_removed(i);
+            }
+
+            // compact first if we do not have space for all the pages. 
+            // The slots in the tombstones should not move while we
+            // write them
+            const uint32_t pages = 1 + (tombstones / tombstones_per_page);
 
-                // write the new data
-                Flash::write(start_address + (i * 1024), p);
+            if ((next_page + pages) > pages_per_bank) {
+                compact();
+            }
+
+            // add all the tombstones. The page buffer might still have
+            // some new entries. A full page is written directly
+            for (uint32_t i = 0; i < committed; i++) {
+                if (!is_removed(i)) {
+                    continue;
+                }
+
+                page.trailer.removed[page.trailer.tombstones] = index[i];
+                page.trailer.tombstones++;
+
+                if (page.trailer.tombstones == tombstones_per_page) {
+                    flush_page(0x00);
+                }
             }
+
+            // write the last page. This commits all the changes
+            flush_page(flag_commit);
+
+            // remove the entries from the index starting from 
+            // the back
+            for (uint32_t i = committed; i > 0; i--) {
+                if (!is_removed(i - 1)) {
+                    continue;
+                }
+
+                for (uint32_t j = i; j < index.size(); j++) {
+                    index[j - 1] = index[j];
+                }
+
+                index.pop_back();
+            }
+
+            // clear the transaction
+            removed = {};
+            committed = index.size();
+
+            // the new entries are visible now
+            publish();
         }
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,177 @@
+/**
+ * @brief Host measurement of the bytes the main loop sends to the 
+ * display. Runs the totp screen (ui/totp.hpp) with the same frame
+ * scheduling and strip loop as main.cpp and counts the strips its
+ * damage covers. The rtc and the systick are simulated
+ * 
+ */
+#include <cstdio>
+#include <cstring>
+
+#include <ui/totp.hpp>
+
+// framebuffer with the size of a single strip
+struct strip {
+    constexpr static uint32_t width = 240;
+    constexpr static uint32_t height = 8;
+
+    void set_pixel(const klib::vector2u, const klib::graphics::color) {}
+    void clear(const klib::graphics::color) {}
+};
+
+// size of the display
+constexpr static int32_t display_width = 240;
+constexpr static int32_t display_height = 135;
+
+// bytes in a strip (rgb565)
+constexpr static uint32_t strip_bytes = strip::width * strip::height * 2;
+
+// min time between two frames (60 fps)
+constexpr static uint64_t fps_frametime = 1'000'000 / 60;
+
+// epoch of the rtc when the measurement starts
+constexpr static uint32_t start_epoch = 1'700'000'000;
+
+/**
+ * @brief Rtc that follows the simulated systick
+ * 
+ */
+struct rtc {
+    static klib::time::s get() {
+        return klib::time::s(start_epoch + (klib::io::systick<>::runtime.value / 1'000'000));
+    }
+};
+
+struct rtc_periph {
+    struct registers {
+        uint32_t GPREG4;
+    };
+
+    static inline registers values = {};
+    static inline registers *const port = &values;
+};
+
+/**
+ * @brief Storage with a single 6 digit profile
+ * 
+ */
+struct profiles {
+    static inline storage::entry profile = {};
+    static inline hmac::midstate state = {};
+
+    static void init() {
+        std::strcpy(profile.str, "host");
+        profile.digits = storage::digit::digits_6;
+        profile.interval = 30;
+
+        const uint8_t key[] = "12345678901234567890";
+        state = hmac::precompute(key, sizeof(key) - 1);
+    }
+
+    static const profiles& pin() {
+        const static profiles p = {};
+
+        return p;
+    }
+
+    static uint32_t size() {
+        return 1;
+    }
+
+    static const storage::entry& get(const uint32_t) {
+        return profile;
+    }
+
+    static const hmac::midstate& get_midstate(const uint32_t) {
+        return state;
+    }
+};
+
+struct usb {
+    struct device {
+        template <typename Usb>
+        static bool is_configured() {
+            return false;
+        }
+
+        template <typename Usb, bool Async>
+        static void write(const char*, const uint32_t) {}
+    };
+};
+
+using totp = menu::totp<strip, profiles, rtc, rtc_periph, usb>;
+
+/**
+ * @brief Count the bytes the main loop sends for the damage of the 
+ * screen and clear the damage
+ * 
+ * @param s 
+ * @return uint32_t 
+ */
+static uint32_t flush(totp& s) {
+    uint32_t ret = 0;
+
+    for (int32_t i = 0; i < display_height; i += strip::height) {
+        if (s.is_damaged({0, i}, {display_width, i + static_cast<int32_t>(strip::height)})) {
+            ret += strip_bytes;
+        }
+    }
+
+    s.clear_damage();
+
+    return ret;
+}
+
+int main() {
+    profiles::init();
+
+    // start halfway a second so the first frames do not line up 
+    // with the rtc
+    auto& runtime = klib::io::systick<>::runtime;
+    runtime = 500'000;
+
+    totp screen;
+    const input::buttons buttons = {
+        input::state::no_change, input::state::no_change, input::state::no_change
+    };
+
+    // the main loop marks everything as changed when it switches to
+    // the screen
+    screen.activate(menu::screen_id::splash);
+    screen.invalidate();
+    screen.main(0, buttons);
+
+    std::printf("totp first frame:       %6u bytes\n", flush(screen));
+
+    // run a full interval of the profile like the main loop does
+    constexpr static uint64_t duration = 30'000'000;
+
+    const uint64_t end = runtime.value + duration;
+    uint64_t previous = runtime.value;
+    uint32_t frames = 0;
+    uint32_t empty = 0;
+    uint64_t bytes = 0;
+    uint32_t max_bytes = 0;
+
+    while (runtime.value < end) {
+        screen.main(runtime.value - previous, buttons);
+        previous = runtime.value;
+
+        const uint32_t sent = flush(screen);
+
+        frames++;
+        bytes += sent;
+        empty += !sent;
+        max_bytes = klib::max(max_bytes, sent);
+
+        // sleep until the screen needs a new frame
+        runtime = runtime.value + klib::max(screen.next_frame().value, fps_frametime);
+    }
+
+    std::printf("totp frames per second: %6.1f\n", frames / (duration / 1'000'000.0));
+    std::printf("totp frames without damage: %2u%%\n", (empty * 100) / frames);
+    std::printf("totp bytes per frame:   %6u avg, %u max\n", static_cast<uint32_t>(bytes / frames), max_bytes);
+    std::printf("totp bytes per second:  %6u\n", static_cast<uint32_t>(bytes / (duration / 1'000'000)));
+
+    return 0;
+}
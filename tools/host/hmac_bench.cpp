@@ -0,0 +1,85 @@
+/**
+ * @brief Host benchmark of the totp hmac (hmac.hpp). Measures the 
+ * time of a token using the generic sha1 and the fixed length 
+ * sha1_totp, both with the midstates of the key precomputed once 
+ * (as the storage does) and with the key hashed for every token
+ * 
+ * Run it on a idle machine. The cycles come from the time stamp 
+ * counter and are only a relative measure
+ * 
+ */
+#include <chrono>
+#include <cstdio>
+
+#include <x86intrin.h>
+
+#include <hmac.hpp>
+
+// amount of tokens for every measurement
+constexpr static uint32_t tokens = 1'000'000;
+
+// key of the rfc 6238 sha1 test vectors. Not constant so the 
+// compiler cannot calculate the midstates once for the whole loop
+static uint8_t key[] = "12345678901234567890";
+
+/**
+ * @brief Tell the compiler the key can be changed at any time
+ * 
+ */
+static void clobber() {
+    asm volatile("" : : "r"(key) : "memory");
+}
+
+/**
+ * @brief Measure a token function and print the result
+ * 
+ * @param name 
+ * @param function 
+ */
+template <typename F>
+static void measure(const char* name, F function) {
+    // xor all the tokens so the compiler cannot skip any
+    uint32_t result = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t cycles = __rdtsc();
+
+    for (uint32_t i = 0; i < tokens; i++) {
+        result ^= function(1'700'000'000 / 30 + i);
+    }
+
+    const uint64_t elapsed_cycles = __rdtsc() - cycles;
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    std::printf("%-36s %6.1f ns %6llu cycles per token (%08x)\n", name, 
+        std::chrono::duration<double, std::nano>(elapsed).count() / tokens,
+        static_cast<unsigned long long>(elapsed_cycles / tokens), result
+    );
+}
+
+int main() {
+    // midstates of the key. Calculated once like the storage does
+    const hmac::midstate state = hmac::precompute(key, sizeof(key) - 1);
+
+    measure("sha1, key hashed every token", [](const uint64_t counter) {
+        clobber();
+
+        return hmac::totp<hmac::sha1>(hmac::precompute(key, sizeof(key) - 1), counter, 6);
+    });
+
+    measure("sha1, precomputed midstates", [&state](const uint64_t counter) {
+        return hmac::totp<hmac::sha1>(state, counter, 6);
+    });
+
+    measure("sha1_totp, key hashed every token", [](const uint64_t counter) {
+        clobber();
+
+        return hmac::totp<hmac::sha1_totp>(hmac::precompute(key, sizeof(key) - 1), counter, 6);
+    });
+
+    measure("sha1_totp, precomputed midstates", [&state](const uint64_t counter) {
+        return hmac::totp<hmac::sha1_totp>(state, counter, 6);
+    });
+
+    return 0;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+// host stand-in for the klib dynamic array. Only has what the 
+// headers of the project use
+namespace klib {
+    template <typename T, uint32_t Size>
+    class dynamic_array {
+    protected:
+        T store[Size] = {};
+        uint32_t count = 0;
+
+    public:
+        constexpr uint32_t size() const { return count; }
+        constexpr uint32_t max_size() const { return Size; }
+        constexpr bool empty() const { return !count; }
+        constexpr void push_back(const T& value) { store[count++] = value; }
+        constexpr void pop_back() { count--; }
+        constexpr void clear() { count = 0; }
+        constexpr T* data() { return store; }
+        constexpr const T* data() const { return store; }
+        constexpr T& operator[](const uint32_t index) { return store[index]; }
+        constexpr const T& operator[](const uint32_t index) const { return store[index]; }
+        constexpr T& back() { return store[count - 1]; }
+        constexpr T* begin() { return store; }
+        constexpr T* end() { return store + count; }
+        constexpr const T* begin() const { return store; }
+        constexpr const T* end() const { return store + count; }
+    };
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+#include <klib/math.hpp>
+
+// host stand-in for the klib colors, fonts and strings. The host
+// tools do not draw anything
+namespace klib::graphics {
+    struct color {};
+
+    constexpr static color black = {};
+    constexpr static color white = {};
+    constexpr static color blue = {};
+
+    struct ascii_font_8x8 {
+        constexpr static uint32_t width = 8;
+        constexpr static uint32_t height = 8;
+    };
+
+    struct ascii_font_16x16 {
+        constexpr static uint32_t width = 16;
+        constexpr static uint32_t height = 16;
+    };
+
+    template <typename Font>
+    struct string {
+        using font = Font;
+
+        template <typename FrameBuffer>
+        static void draw(FrameBuffer&, const char*, const klib::vector2i, const color, const color = {}) {}
+    };
+}
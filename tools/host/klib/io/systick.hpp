@@ -0,0 +1,25 @@
+#pragma once
+
+#include <type_traits>
+
+#include <klib/units.hpp>
+
+// host stand-in for the klib systick. The host tools set the 
+// runtime
+namespace klib::io {
+    template <typename = void>
+    class systick {
+    public:
+        static inline klib::time::us runtime = {};
+
+        template <typename T = klib::time::ms>
+        static T get_runtime() {
+            if constexpr (std::is_same_v<T, klib::time::us>) {
+                return runtime;
+            }
+            else {
+                return T(runtime.value / 1000);
+            }
+        }
+    };
+}
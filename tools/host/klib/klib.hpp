@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+// host stand-in for the klib target functions and the cmsis 
+// functions the headers use. The host tools that need them provide
+// the definitions
+using IRQn_Type = int32_t;
+
+void NVIC_EnableIRQ(const IRQn_Type irq);
+uint32_t NVIC_GetPendingIRQ(const IRQn_Type irq);
+void __WFI();
+
+// systick registers of the cortex-m
+struct SysTick_Type {
+    uint32_t CTRL;
+};
+
+inline SysTick_Type systick_registers = {};
+
+#define SysTick (&systick_registers)
+
+constexpr static uint32_t SysTick_CTRL_ENABLE_Msk = 0x1;
+
+namespace klib::target {
+    void disable_irq();
+    void enable_irq();
+}
+
+namespace klib::target::irq {
+    void register_irq(const uint32_t id, void (*handler)());
+
+    template <uint32_t Id>
+    void register_irq(void (*handler)()) {
+        register_irq(Id, handler);
+    }
+}
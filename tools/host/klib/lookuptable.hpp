@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+// host stand-in for the klib lookuptable
+namespace klib {
+    template <uint32_t Size, typename T>
+    class lookuptable {
+    protected:
+        T values[Size] = {};
+
+    public:
+        constexpr static uint32_t size = Size;
+
+        template <typename F>
+        constexpr lookuptable(F function) {
+            for (uint32_t i = 0; i < Size; i++) {
+                values[i] = static_cast<T>(function(i));
+            }
+        }
+
+        constexpr T get(const uint32_t index) const { return values[index]; }
+    };
+}
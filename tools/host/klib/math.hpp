@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+// host stand-in for the klib math and vector helpers
+namespace klib {
+    template <typename T>
+    constexpr T max(const T a, const T b) { return (a > b) ? a : b; }
+
+    template <typename T>
+    constexpr T min(const T a, const T b) { return (a < b) ? a : b; }
+
+    constexpr double pow(const double value, const uint32_t power) {
+        double ret = 1;
+
+        for (uint32_t i = 0; i < power; i++) {
+            ret *= value;
+        }
+
+        return ret;
+    }
+
+    template <typename T>
+    struct vector2 {
+        T x;
+        T y;
+
+        template <typename U>
+        constexpr vector2<U> cast() const { return {static_cast<U>(x), static_cast<U>(y)}; }
+
+        constexpr vector2 operator+(const vector2& other) const { return {x + other.x, y + other.y}; }
+        constexpr vector2 operator-(const vector2& other) const { return {x - other.x, y - other.y}; }
+    };
+
+    using vector2i = vector2<int32_t>;
+    using vector2u = vector2<uint32_t>;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+
+// host stand-in for the klib string helpers
+namespace klib::string {
+    namespace detail {
+        constexpr uint32_t count_chars(uint32_t value) {
+            uint32_t ret = 1;
+
+            while (value >= 10) {
+                value /= 10;
+                ret++;
+            }
+
+            return ret;
+        }
+    }
+
+    constexpr uint32_t strlen(const char* str) {
+        uint32_t ret = 0;
+
+        while (str[ret]) {
+            ret++;
+        }
+
+        return ret;
+    }
+
+    constexpr char* strcpy(char* destination, const char* source) {
+        uint32_t i = 0;
+
+        for (; source[i]; i++) {
+            destination[i] = source[i];
+        }
+
+        destination[i] = 0;
+
+        return destination;
+    }
+
+    constexpr char* strcat(char* destination, const char* source) {
+        strcpy(destination + strlen(destination), source);
+
+        return destination;
+    }
+
+    template <typename T>
+    constexpr char* itoa(const T value, char* str) {
+        const uint32_t count = detail::count_chars(static_cast<uint32_t>(value));
+        uint32_t v = static_cast<uint32_t>(value);
+
+        for (uint32_t i = 0; i < count; i++) {
+            str[count - 1 - i] = '0' + (v % 10);
+            v /= 10;
+        }
+
+        str[count] = 0;
+
+        return str;
+    }
+
+    constexpr void set_width(char* str, const uint32_t width, const char fill) {
+        const uint32_t length = strlen(str);
+
+        if (length >= width) {
+            return;
+        }
+
+        // move the string to the end and fill the start
+        for (uint32_t i = 0; i <= length; i++) {
+            str[width - i] = str[length - i];
+        }
+
+        for (uint32_t i = 0; i < (width - length); i++) {
+            str[i] = fill;
+        }
+    }
+}
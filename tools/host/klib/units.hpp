@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+// host stand-in for the klib time units
+namespace klib::time {
+    struct us {
+        uint64_t value;
+
+        constexpr us(const uint64_t value = 0): value(value) {}
+
+        constexpr us operator+(const us other) const { return value + other.value; }
+        constexpr us operator-(const us other) const { return value - other.value; }
+        constexpr auto operator<=>(const us& other) const = default;
+    };
+
+    struct ms {
+        uint64_t value;
+
+        constexpr ms(const uint64_t value = 0): value(value) {}
+
+        constexpr explicit operator us() const { return value * 1000; }
+
+        constexpr ms operator+(const ms other) const { return value + other.value; }
+        constexpr ms operator-(const ms other) const { return value - other.value; }
+        constexpr auto operator<=>(const ms& other) const = default;
+    };
+
+    struct s {
+        uint32_t value;
+
+        constexpr s(): value(0) {}
+        constexpr explicit s(const uint32_t value): value(value) {}
+
+        constexpr explicit operator ms() const { return static_cast<uint64_t>(value) * 1000; }
+
+        constexpr auto operator<=>(const s& other) const = default;
+    };
+}
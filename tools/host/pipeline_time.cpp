@@ -0,0 +1,362 @@
+/**
+ * @brief Host measurement of the time the cpu waits for the display
+ * when drawing a full frame. Runs the render pipeline (pipeline.hpp)
+ * against a simulated gpdma and ssp. The dma follows the list items
+ * the pipeline sets up and only interrupts when the pipeline enabled
+ * the terminal count interrupt. The loop before the pipeline (spin
+ * on the busy flags after drawing every strip) runs on the same 
+ * simulation
+ * 
+ * The timing comes from the readme: drawing a full frame takes 
+ * around 6 ms and the ssp runs at 48 MHz
+ * 
+ * The pipeline uses 32 bit addresses for the dma. Build without pie
+ * so everything is in the low 4 GB (x86-64 linux)
+ * 
+ */
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <span>
+
+#include <klib/klib.hpp>
+#include <klib/math.hpp>
+
+#include <pipeline.hpp>
+
+// size of the display and the strips
+constexpr static uint32_t display_height = 135;
+constexpr static uint32_t strip_height = 8;
+constexpr static uint32_t strips = (display_height + strip_height - 1) / strip_height;
+
+// time to draw a strip in nanoseconds (6 ms for a full frame)
+constexpr static uint64_t draw_time = 6'000'000 / strips;
+
+// time to send a byte over the ssp in nanoseconds (48 MHz)
+constexpr static uint64_t byte_time = (8 * 1'000'000'000ull) / 48'000'000;
+
+// framebuffer with the size of a single strip
+struct strip {
+    constexpr static uint32_t width = 240;
+    constexpr static uint32_t height = strip_height;
+
+    uint8_t pixels[width * height * 2];
+};
+
+/**
+ * @brief Simulated time and interrupts
+ * 
+ */
+namespace sim {
+    // current time in nanoseconds
+    static uint64_t now = 0;
+
+    // time the cpu was waiting for the display
+    static uint64_t waiting = 0;
+
+    // flag if the interrupts are enabled and if the dma interrupt
+    // is pending
+    static bool enabled = true;
+    static bool pending = false;
+
+    // handler of the dma interrupt
+    static void (*handler)() = nullptr;
+
+    // time the current dma transfer is done. 0 when the dma is
+    // not running
+    static uint64_t done = 0;
+
+    /**
+     * @brief Run the interrupt when it is pending and the 
+     * interrupts are enabled
+     * 
+     */
+    static void dispatch() {
+        if (pending && enabled) {
+            pending = false;
+            handler();
+        }
+    }
+}
+
+/**
+ * @brief Registers of the gpdma
+ * 
+ */
+struct gpdma_registers {
+    uint32_t INTSTAT;
+    uint32_t INTTCSTAT;
+    uint32_t INTTCCLEAR;
+    uint32_t reserved[(0x100 - 0xc) / 4];
+
+    struct {
+        uint32_t SRCADDR;
+        uint32_t DESTADDR;
+        uint32_t LLI;
+        uint32_t CONTROL;
+        uint32_t CONFIG;
+        uint32_t reserved[3];
+    } channels[8];
+};
+
+struct dma_periph {
+    constexpr static uint32_t interrupt_id = 42;
+
+    static inline gpdma_registers registers = {};
+    static inline gpdma_registers *const port = &registers;
+};
+
+/**
+ * @brief Registers of the ssp
+ * 
+ */
+struct ssp_registers {
+    uint32_t CR0;
+    uint32_t CR1;
+    uint32_t DR;
+    uint32_t SR;
+    uint32_t CPSR;
+    uint32_t IMSC;
+    uint32_t RIS;
+    uint32_t MIS;
+    uint32_t ICR;
+    uint32_t DMACR;
+};
+
+struct ssp_periph {
+    static inline ssp_registers registers = {};
+    static inline ssp_registers *const port = &registers;
+};
+
+/**
+ * @brief Ssp that sends the bytes that are not using the dma. 
+ * Blocks for the time it takes to send them
+ * 
+ */
+struct ssp {
+    static bool is_busy() {
+        return false;
+    }
+
+    static void write(const std::span<const uint8_t> data) {
+        sim::now += data.size() * byte_time;
+    }
+
+    static void clear_rx_fifo() {}
+};
+
+struct dc {
+    template <bool Value>
+    static void set() {}
+};
+
+/**
+ * @brief Start the simulated transfer when the pipeline enabled the
+ * channel. Walks the list items to get the amount of bytes
+ * 
+ */
+static void start_dma() {
+    auto& tx = dma_periph::port->channels[0];
+
+    if (!(tx.CONFIG & 0x1) || sim::done) {
+        return;
+    }
+
+    // the ssp must request data from the dma
+    if (!(ssp_periph::port->DMACR & (0x1 << 1))) {
+        std::printf("ssp does not request data from the dma\n");
+        std::exit(1);
+    }
+
+    uint32_t bytes = tx.CONTROL & 0xfff;
+    uint32_t control = tx.CONTROL;
+
+    for (uint32_t next = tx.LLI; next; ) {
+        const uint32_t *const item = reinterpret_cast<const uint32_t*>(static_cast<uintptr_t>(next));
+
+        bytes += item[3] & 0xfff;
+        control = item[3];
+        next = item[2];
+    }
+
+    // the last item should have the interrupt enabled and the channel
+    // should not mask it
+    if (!(control & (0x1u << 31)) || !(tx.CONFIG & (0x1 << 15))) {
+        std::printf("terminal count interrupt is not enabled\n");
+        std::exit(1);
+    }
+
+    sim::done = sim::now + bytes * byte_time;
+}
+
+/**
+ * @brief Run the simulation up to a time. Finishes the dma transfer
+ * when it is done
+ * 
+ * @param time 
+ */
+static void run_until(const uint64_t time) {
+    start_dma();
+
+    if (sim::done && (sim::done <= time)) {
+        sim::now = sim::done;
+        sim::done = 0;
+
+        // disable the channel and set the interrupt
+        dma_periph::port->channels[0].CONFIG &= ~0x1;
+        dma_periph::port->INTTCSTAT |= 0x1;
+        sim::pending = true;
+    }
+
+    sim::now = klib::max(sim::now, time);
+}
+
+void NVIC_EnableIRQ(const IRQn_Type) {}
+
+void __WFI() {
+    start_dma();
+
+    // nothing would wake us up
+    if (!sim::done && !sim::pending) {
+        std::printf("sleeping without a interrupt that wakes us up\n");
+        std::exit(1);
+    }
+
+    const uint64_t start = sim::now;
+
+    if (!sim::pending) {
+        run_until(sim::done);
+    }
+
+    sim::waiting += sim::now - start;
+}
+
+namespace klib::target {
+    void disable_irq() {
+        sim::enabled = false;
+    }
+
+    void enable_irq() {
+        sim::enabled = true;
+        sim::dispatch();
+    }
+}
+
+namespace klib::target::irq {
+    void register_irq(const uint32_t, void (*handler)()) {
+        sim::handler = handler;
+    }
+}
+
+/**
+ * @brief Clear the interrupt of the dma when the simulation did not
+ * have the pipeline installed
+ * 
+ */
+static void clear_interrupt() {
+    dma_periph::port->INTTCCLEAR = dma_periph::port->INTTCSTAT;
+    dma_periph::port->INTTCSTAT = 0;
+}
+
+/**
+ * @brief Draw a full frame using the render pipeline
+ * 
+ * @return uint64_t 
+ */
+template <typename Pipeline>
+static uint64_t pipeline_frame() {
+    const uint64_t start = sim::now;
+
+    for (uint32_t i = 0; i < display_height; i += strip_height) {
+        Pipeline::acquire();
+        run_until(sim::now + draw_time);
+        sim::dispatch();
+        Pipeline::submit(i);
+    }
+
+    Pipeline::wait();
+
+    return sim::now - start;
+}
+
+/**
+ * @brief Draw a full frame the way the main loop did before the
+ * pipeline. Draws a strip and spins on the busy flags before it
+ * flushes it
+ * 
+ * @return uint64_t 
+ */
+static uint64_t spin_frame() {
+    const uint64_t start = sim::now;
+
+    for (uint32_t i = 0; i < display_height; i += strip_height) {
+        run_until(sim::now + draw_time);
+
+        // spin until the previous strip is sent
+        if (sim::done) {
+            sim::waiting += sim::done - sim::now;
+            run_until(sim::done);
+        }
+
+        clear_interrupt();
+        sim::pending = false;
+
+        // set the window and send the strip
+        ssp::write(std::span<const uint8_t>(strip{}.pixels, 11));
+        sim::done = sim::now + (sizeof(strip::pixels) * byte_time);
+    }
+
+    if (sim::done) {
+        sim::waiting += sim::done - sim::now;
+        run_until(sim::done);
+    }
+
+    return sim::now - start;
+}
+
+int main() {
+    constexpr static uint32_t frames = 100;
+
+    // framebuffers of the pipeline
+    static std::array<strip, 3> framebuffers = {};
+
+    using pipeline = render::pipeline<
+        strip, framebuffers.size(), dma_periph, 0, 2, 
+        ssp, ssp_periph, dc, 40, 52
+    >;
+
+    // before the pipeline
+    uint64_t total = 0;
+
+    for (uint32_t i = 0; i < frames; i++) {
+        total += spin_frame();
+    }
+
+    const uint64_t spin_total = total / frames;
+    const uint64_t spin_waiting = sim::waiting / frames;
+
+    // using the pipeline
+    pipeline::init(framebuffers);
+
+    total = 0;
+    sim::waiting = 0;
+
+    for (uint32_t i = 0; i < frames; i++) {
+        total += pipeline_frame<pipeline>();
+    }
+
+    const uint64_t pipeline_total = total / frames;
+    const uint64_t pipeline_waiting = sim::waiting / frames;
+
+    std::printf("full frame, spinning on the busy flags: %5llu us, cpu spinning %5llu us\n", 
+        static_cast<unsigned long long>(spin_total / 1000), 
+        static_cast<unsigned long long>(spin_waiting / 1000)
+    );
+
+    std::printf("full frame, render pipeline:            %5llu us, cpu sleeping  %5llu us\n", 
+        static_cast<unsigned long long>(pipeline_total / 1000), 
+        static_cast<unsigned long long>(pipeline_waiting / 1000)
+    );
+
+    return 0;
+}
@@ -0,0 +1,180 @@
+/**
+ * @brief Host build of the profile command protocol (protocol.hpp).
+ * Speaks the protocol on stdin and stdout so tools/totp_client.py
+ * can drive it using --exec. The storage runs on a flash image in a
+ * file so the profiles are kept between runs
+ *
+ *   protocol_device [flash image]
+ *
+ * The storage uses 32 bit flash addresses. The image is mapped in
+ * the low 4 GB of the address space (x86-64 linux)
+ *
+ */
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <span>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <protocol.hpp>
+
+// size of the flash image. Same as the storage sector
+constexpr static uint32_t flash_size = 32 * 1024;
+
+/**
+ * @brief Flash stand-in on top of the mapped image. Checks the
+ * same rules as the flash of the lpc1756
+ *
+ */
+struct flash {
+    enum class erase_mode {
+        sector
+    };
+
+    // start of the mapped image
+    static inline uint8_t* base = nullptr;
+
+    static void erase(const erase_mode, const uint32_t address) {
+        std::memset(reinterpret_cast<uint8_t*>(address), 0xff, 32 * 1024);
+    }
+
+    static void write(const uint32_t address, const std::span<const uint8_t> data) {
+        uint8_t *const ptr = reinterpret_cast<uint8_t*>(address);
+
+        for (uint32_t i = 0; i < data.size(); i++) {
+            // flash can only change bits from 1 to 0
+            if ((ptr[i] & data[i]) != data[i]) {
+                std::fprintf(stderr, "write to a non erased byte at 0x%08x\n", address + i);
+            }
+
+            ptr[i] &= data[i];
+        }
+    }
+};
+
+/**
+ * @brief Rtc stand-in. Runs on the clock of the host and prints 
+ * the time the client sets
+ *
+ */
+struct rtc {
+    // difference between the rtc and the clock of the host
+    static inline int64_t offset = 0;
+
+    static klib::time::s get() {
+        return klib::time::s(static_cast<uint32_t>(std::time(nullptr) + offset));
+    }
+
+    static void set(const klib::time::s time) {
+        offset = static_cast<int64_t>(time.value) - std::time(nullptr);
+
+        std::fprintf(stderr, "rtc set to %u\n", time.value);
+    }
+};
+
+/**
+ * @brief Rtc registers stand-in. Only has the registers the drift
+ * history uses. These are lost between runs
+ *
+ */
+struct rtc_periph {
+    struct registers {
+        uint32_t CCR;
+        uint32_t CALIBRATION;
+        uint32_t GPREG0;
+        uint32_t GPREG1;
+        uint32_t GPREG2;
+        uint32_t GPREG3;
+        uint32_t GPREG4;
+    };
+
+    static inline registers values = {};
+    static inline registers *const port = &values;
+};
+
+/**
+ * @brief Transport that writes the responses to stdout
+ *
+ */
+struct transport {
+    static void write(const uint8_t* data, const uint32_t size) {
+        std::fwrite(data, 1, size, stdout);
+        std::fflush(stdout);
+    }
+};
+
+/**
+ * @brief Ram the storage uses while it erases the sector
+ *
+ */
+struct staging {
+    static std::span<uint8_t> get() {
+        static uint8_t buffer[16 * 1024];
+
+        return {buffer, sizeof(buffer)};
+    }
+};
+
+using storage_t = storage::storage<flash, staging>;
+using handler = protocol::handler<storage_t, rtc, rtc_periph, transport>;
+
+int main(int argc, char** argv) {
+    const char *const path = (argc > 1) ? argv[1] : "flash.bin";
+
+    const int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0) {
+        std::perror(path);
+
+        return 1;
+    }
+
+    // a new image starts erased
+    struct stat info;
+    fstat(fd, &info);
+
+    const bool erased = (info.st_size == 0);
+
+    if (ftruncate(fd, flash_size) != 0) {
+        std::perror(path);
+
+        return 1;
+    }
+
+    void *const image = mmap(
+        nullptr, flash_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_32BIT, fd, 0
+    );
+
+    if (image == MAP_FAILED) {
+        std::perror("mmap");
+
+        return 1;
+    }
+
+    flash::base = static_cast<uint8_t*>(image);
+
+    if (erased) {
+        std::memset(flash::base, 0xff, flash_size);
+    }
+
+    const uint32_t start = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(flash::base));
+    storage_t::init({}, start, start + flash_size);
+
+    // handle every byte we get like the main loop does
+    int data;
+
+    while ((data = std::getchar()) != EOF) {
+        handler::push(static_cast<uint8_t>(data));
+
+        while (handler::update()) {
+            // keep running
+        }
+    }
+
+    return 0;
+}
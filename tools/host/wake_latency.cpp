@@ -0,0 +1,343 @@
+/**
+ * @brief Host measurement of the time from a wake up event in the 
+ * idle mode until the first frame of the totp screen is on the 
+ * display. Runs the idle mode and the usb wake source (power.hpp) 
+ * and the totp screen (ui/totp.hpp) with the steps of the main 
+ * loop. The systick, the display and the start of frames of the 
+ * host are simulated
+ * 
+ * The time to draw and send a strip comes from the readme: drawing
+ * a full frame takes around 6 ms and the ssp runs at 48 MHz. The 
+ * render pipeline draws the next strip while the previous one is
+ * sent
+ * 
+ */
+#include <cstdio>
+#include <cstdlib>
+
+#include <power.hpp>
+#include <ui/totp.hpp>
+
+// framebuffer with the size of a single strip
+struct strip {
+    constexpr static uint32_t width = 240;
+    constexpr static uint32_t height = 8;
+
+    void set_pixel(const klib::vector2u, const klib::graphics::color) {}
+    void clear(const klib::graphics::color) {}
+};
+
+// size of the display
+constexpr static int32_t display_width = 240;
+constexpr static int32_t display_height = 135;
+constexpr static uint32_t strips = (display_height + strip::height - 1) / strip::height;
+
+// time to draw and to send a strip in microseconds
+constexpr static double draw_time = 6'000.0 / strips;
+constexpr static double send_time = (strip::width * strip::height * 2 * 8) / 48.0;
+
+// time of a systick interrupt and between two start of frames
+constexpr static uint64_t tick = 1'000;
+
+// epoch of the rtc when the measurement starts
+constexpr static uint32_t start_epoch = 1'700'000'000;
+
+// usb interrupt
+constexpr static IRQn_Type usb_irq = 24;
+
+/**
+ * @brief Simulated hardware
+ * 
+ */
+namespace sim {
+    // flag if the usb interrupt is pending
+    static bool usb_pending = false;
+
+    // time of the first start of frame of the host. 0 when the 
+    // host does not send frames
+    static uint64_t frame_start = 0;
+
+    // last time the frame flag was cleared
+    static uint64_t cleared = 0;
+
+    // flag if the backlight is on
+    static bool backlight = true;
+}
+
+// runtime of the simulated systick
+static auto& runtime = klib::io::systick<>::runtime;
+
+void NVIC_EnableIRQ(const IRQn_Type) {}
+
+uint32_t NVIC_GetPendingIRQ(const IRQn_Type irq) {
+    return (irq == usb_irq) && sim::usb_pending;
+}
+
+void __WFI() {
+    // the systick wakes us up
+    runtime = ((runtime.value / tick) + 1) * tick;
+}
+
+namespace klib::target {
+    void disable_irq() {}
+    void enable_irq() {}
+}
+
+struct ssp {
+    static bool is_busy() {
+        return false;
+    }
+
+    static void write(const std::span<const uint8_t>) {}
+    static void clear_rx_fifo() {}
+};
+
+struct dc {
+    template <bool Value>
+    static void set() {}
+};
+
+struct blk {
+    template <bool Value>
+    static void set() {
+        // the backlight is active low
+        sim::backlight = !Value;
+    }
+};
+
+/**
+ * @brief Usb registers. The start of frame flag is set when the 
+ * host sent a frame after it was cleared
+ * 
+ */
+struct usb_periph {
+    struct registers {
+        struct status {
+            operator uint32_t() const {
+                if (!sim::frame_start || (runtime.value < sim::frame_start)) {
+                    return 0;
+                }
+
+                // time of the last frame
+                const uint64_t frame = runtime.value - ((runtime.value - sim::frame_start) % tick);
+
+                return frame >= sim::cleared;
+            }
+        };
+
+        struct clear {
+            clear& operator=(const uint32_t) {
+                sim::cleared = runtime.value;
+
+                return *this;
+            }
+        };
+
+        status DEVINTST;
+        clear DEVINTCLR;
+    };
+
+    static inline registers values = {};
+    static inline registers *const port = &values;
+};
+
+/**
+ * @brief Rtc that follows the simulated systick
+ * 
+ */
+struct rtc {
+    static klib::time::s get() {
+        return klib::time::s(start_epoch + (runtime.value / 1'000'000));
+    }
+};
+
+struct rtc_periph {
+    struct registers {
+        uint32_t GPREG4;
+    };
+
+    static inline registers values = {};
+    static inline registers *const port = &values;
+};
+
+/**
+ * @brief Storage with a single 6 digit profile
+ * 
+ */
+struct profiles {
+    static inline storage::entry profile = {};
+    static inline hmac::midstate state = {};
+
+    static void init() {
+        klib::string::strcpy(profile.str, "profile");
+        profile.digits = storage::digit::digits_6;
+        profile.interval = 30;
+
+        state = hmac::precompute(reinterpret_cast<const uint8_t*>("12345678901234567890"), 20);
+    }
+
+    static uint32_t size() {
+        return 1;
+    }
+
+    static const storage::entry& get(const uint32_t) {
+        return profile;
+    }
+
+    static const hmac::midstate& get_midstate(const uint32_t) {
+        return state;
+    }
+
+    // the profiles never change so the snapshot is the storage
+    // itself
+    static profiles pin() {
+        return {};
+    }
+};
+
+struct usb {
+    struct device {
+        template <typename Usb>
+        static bool is_configured() {
+            return false;
+        }
+
+        template <typename Usb, bool Async>
+        static void write(const char*, const uint32_t) {}
+    };
+};
+
+using totp = menu::totp<strip, profiles, rtc, rtc_periph, usb>;
+using idle = power::idle<ssp, dc, blk>;
+using usb_wake = power::usb_wake<usb_periph, usb_irq>;
+
+/**
+ * @brief Count the strips the main loop sends for the damage of 
+ * the screen and clear the damage
+ * 
+ * @param s 
+ * @return uint32_t 
+ */
+static uint32_t flush(totp& s) {
+    uint32_t ret = 0;
+
+    for (int32_t i = 0; i < display_height; i += strip::height) {
+        ret += s.is_damaged({0, i}, {display_width, i + static_cast<int32_t>(strip::height)});
+    }
+
+    s.clear_damage();
+
+    return ret;
+}
+
+/**
+ * @brief Source of the wake up
+ * 
+ */
+enum class source {
+    button,
+    usb
+};
+
+/**
+ * @brief Sleep in the idle mode and wake up at a random time. 
+ * Returns the time from the event until the first frame is on the
+ * display in microseconds
+ * 
+ * @param screen 
+ * @param s 
+ * @return double 
+ */
+static double wake(totp& screen, const source s) {
+    const input::buttons buttons = {
+        input::state::no_change, input::state::no_change, input::state::no_change
+    };
+
+    // go to sleep like the main loop does after the screen timeout
+    idle::enter();
+    usb_wake::stop();
+
+    // sleep for a random time between 1 and 60 seconds. The event 
+    // is not aligned to the systick
+    runtime = runtime.value + 1'000'000 + (std::rand() % 59'000'000);
+    const uint64_t event = runtime.value;
+    uint64_t previous = event;
+
+    if (s == source::button) {
+        // the main loop exits the idle mode on the first edge
+        idle::exit();
+    }
+    else {
+        // the host resumes the bus. The first frame is somewhere
+        // in the next millisecond
+        sim::usb_pending = true;
+        sim::frame_start = event + (std::rand() % tick);
+
+        usb_wake::woken();
+
+        sim::usb_pending = false;
+    }
+
+    // run the steps of the main loop until the display is awake
+    while (true) {
+        // the usb is checked in the sleep loop after every interrupt
+        if (idle::is_active() && usb_wake::update()) {
+            idle::exit();
+        }
+
+        idle::update();
+
+        screen.main(runtime.value - previous, buttons);
+        previous = runtime.value;
+
+        if (!idle::is_active()) {
+            break;
+        }
+
+        // sleep until the next systick interrupt
+        __WFI();
+    }
+
+    // the first strip is drawn before anything is sent. After that
+    // the pipeline sends a strip while the next one is drawn
+    const uint32_t count = flush(screen);
+    const double frame = draw_time + ((count - 1) * klib::max(draw_time, send_time)) + send_time;
+
+    sim::frame_start = 0;
+
+    return (runtime.value - event) + frame;
+}
+
+int main() {
+    profiles::init();
+
+    runtime = 500'000;
+
+    totp screen;
+
+    // draw the first frame
+    screen.activate(menu::screen_id::splash);
+    screen.invalidate();
+    screen.main(0, {input::state::no_change, input::state::no_change, input::state::no_change});
+    flush(screen);
+
+    constexpr static uint32_t wakes = 1000;
+
+    for (const auto s: {source::button, source::usb}) {
+        double total = 0;
+        double max = 0;
+
+        for (uint32_t i = 0; i < wakes; i++) {
+            const double latency = wake(screen, s);
+
+            total += latency;
+            max = klib::max(max, latency);
+        }
+
+        std::printf("wake to first frame, %-6s %6.0f us avg, %6.0f us max\n", 
+            (s == source::button) ? "button" : "usb", total / wakes, max
+        );
+    }
+
+    return 0;
+}
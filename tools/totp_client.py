@@ -0,0 +1,206 @@
+#!/usr/bin/env python3
+"""
+Reference client for the profile command protocol (see protocol.hpp).
+
+The device is reached using a serial port (needs pyserial) or using a
+command that speaks the protocol on stdin/stdout (for example a build
+of the protocol handler for the host).
+
+Examples:
+    totp_client.py --port /dev/ttyACM0 list
+    totp_client.py --port /dev/ttyACM0 add github 30 6 b32:MFRGGZDFMYYTEMZU
+    totp_client.py --port /dev/ttyACM0 remove 2
+    totp_client.py --exec ./simulated_device time now
+"""
+
+import argparse
+import base64
+import binascii
+import struct
+import subprocess
+import sys
+import time
+
+REQUEST_SYNC = 0xa5
+RESPONSE_SYNC = 0x5a
+
+INFO = 0x01
+LIST = 0x02
+BEGIN = 0x03
+ADD = 0x04
+REMOVE = 0x05
+COMMIT = 0x06
+SET_TIME = 0x07
+
+STATUS = {
+    0x00: "ok",
+    0x01: "invalid crc",
+    0x02: "invalid command",
+    0x03: "invalid argument",
+    0x04: "storage full",
+    0x05: "not found",
+}
+
+# size of the name field of a profile (including the null terminator)
+NAME_SIZE = 15
+
+# max size of a key in bytes
+MAX_KEY = 40
+
+
+class ProtocolError(Exception):
+    pass
+
+
+class Device:
+    def __init__(self, read, write):
+        self.read = read
+        self.write = write
+
+    def _read_exact(self, size):
+        data = b""
+
+        while len(data) < size:
+            chunk = self.read(size - len(data))
+
+            if not chunk:
+                raise ProtocolError("device closed the connection")
+
+            data += chunk
+
+        return data
+
+    def request(self, command, payload=b""):
+        body = bytes([command, len(payload)]) + payload
+        self.write(bytes([REQUEST_SYNC]) + body + struct.pack("<I", binascii.crc32(body)))
+
+        # skip everything until the start of a response
+        while self._read_exact(1)[0] != RESPONSE_SYNC:
+            pass
+
+        header = self._read_exact(3)
+        data = self._read_exact(header[2])
+        crc, = struct.unpack("<I", self._read_exact(4))
+
+        if crc != binascii.crc32(header + data):
+            raise ProtocolError("invalid crc in response")
+
+        if header[0] != command:
+            raise ProtocolError("response for a different command")
+
+        if header[1] != 0x00:
+            raise ProtocolError(STATUS.get(header[1], "unknown status 0x%02x" % header[1]))
+
+        return data
+
+    def info(self):
+        version, count, maximum = struct.unpack("<BHH", self.request(INFO))
+
+        return version, count, maximum
+
+    def profiles(self):
+        _, count, _ = self.info()
+
+        for index in range(count):
+            data = self.request(LIST, struct.pack("<H", index))
+            name = data[:NAME_SIZE].split(b"\0")[0].decode(errors="replace")
+
+            yield index, name, data[NAME_SIZE + 1], data[NAME_SIZE]
+
+    def add(self, name, interval, digits, key):
+        raw = name.encode()[:NAME_SIZE - 1].ljust(NAME_SIZE, b"\0")
+        payload = raw + bytes([digits, interval, len(key)]) + key
+
+        self.request(BEGIN)
+        self.request(ADD, payload)
+        self.request(COMMIT)
+
+    def remove(self, index):
+        self.request(BEGIN)
+        self.request(REMOVE, struct.pack("<H", index))
+        self.request(COMMIT)
+
+    def set_time(self, epoch):
+        self.request(SET_TIME, struct.pack("<I", epoch))
+
+
+def parse_key(value):
+    """Key as b32:..., hex:... or a plain string"""
+    if value.startswith("b32:"):
+        key = value[4:].upper()
+        key = base64.b32decode(key + "=" * (-len(key) % 8))
+    elif value.startswith("hex:"):
+        key = bytes.fromhex(value[4:])
+    else:
+        key = value.encode()
+
+    if not key or len(key) > MAX_KEY:
+        raise argparse.ArgumentTypeError("key should be 1 - %d bytes" % MAX_KEY)
+
+    return key
+
+
+def connect(args):
+    if args.exec:
+        process = subprocess.Popen(args.exec, shell=True, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+
+        def write(data):
+            process.stdin.write(data)
+            process.stdin.flush()
+
+        return Device(process.stdout.read1, write)
+
+    import serial
+
+    port = serial.Serial(args.port, timeout=2)
+
+    return Device(port.read, port.write)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    target = parser.add_mutually_exclusive_group(required=True)
+    target.add_argument("--port", help="serial port of the device")
+    target.add_argument("--exec", help="command that speaks the protocol on stdin/stdout")
+
+    commands = parser.add_subparsers(dest="command", required=True)
+    commands.add_parser("info", help="show the amount of profiles")
+    commands.add_parser("list", help="list the profiles")
+
+    add = commands.add_parser("add", help="add a profile")
+    add.add_argument("name")
+    add.add_argument("interval", type=int, choices=range(1, 181), metavar="interval")
+    add.add_argument("digits", type=int, choices=(6, 8))
+    add.add_argument("key", type=parse_key, help="b32:..., hex:... or a string")
+
+    remove = commands.add_parser("remove", help="remove a profile")
+    remove.add_argument("index", type=int)
+
+    clock = commands.add_parser("time", help="set the time of the device")
+    clock.add_argument("epoch", help="utc epoch or 'now'")
+
+    args = parser.parse_args()
+    device = connect(args)
+
+    try:
+        if args.command == "info":
+            version, count, maximum = device.info()
+            print("protocol version %d, %d of %d profiles" % (version, count, maximum))
+        elif args.command == "list":
+            for index, name, interval, digits in device.profiles():
+                print("%3d: %-14s %3ds %d digits" % (index, name, interval, digits))
+        elif args.command == "add":
+            device.add(args.name, args.interval, args.digits, args.key)
+        elif args.command == "remove":
+            device.remove(args.index)
+        elif args.command == "time":
+            device.set_time(int(time.time()) if args.epoch == "now" else int(args.epoch))
+    except ProtocolError as e:
+        print("error: %s" % e, file=sys.stderr)
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
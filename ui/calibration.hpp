@@ -2,18 +2,21 @@
 
 #include <klib/io/rtc.hpp>
 
+#include <drift.hpp>
+
 #include "screen.hpp"
 #include "numeric_popup.hpp"
 #include "popup.hpp"
 
 namespace menu {
-    template <typename FrameBuffer, typename RtcPeriph>
+    template <typename FrameBuffer, typename RtcPeriph, typename Drift>
     class calibration: public screen<FrameBuffer> {
     protected:
         using screen_base = screen<FrameBuffer>;
 
         enum class steps: uint8_t {
-            enabled = 0,
+            automatic = 0,
+            enabled,
             direction,
             calibration,
 
@@ -30,9 +33,64 @@ namespace menu {
         numeric_popup<FrameBuffer>& num_popup;
         popup<FrameBuffer>& str_popup;
 
+        // title with the drift estimate of the rtc
+        char drift_str[16];
+
+        /**
+         * @brief Update the title with the last drift estimate
+         * 
+         */
+        void update_drift() {
+            using history = drift::history<RtcPeriph>;
+
+            if (!Drift::has_estimate() && !history::has_estimate()) {
+                klib::string::strcpy(drift_str, "Drift unknown");
+
+                return;
+            }
+
+            // prefer the usb estimate. It is more accurate than the 
+            // time sets of the user. Round the estimate to parts 
+            // per million
+            const int64_t estimate = (Drift::has_estimate() ? 
+                Drift::estimate() : history::estimate()
+            );
+            const uint32_t ppm = static_cast<uint32_t>(
+                ((estimate < 0) ? -estimate : estimate) + 500
+            ) / 1000;
+
+            klib::string::strcpy(drift_str, (estimate < 0) ? "Drift -" : "Drift +");
+            klib::string::itoa(ppm, drift_str + klib::string::strlen(drift_str));
+            klib::string::strcpy(drift_str + klib::string::strlen(drift_str), "ppm");
+        }
+
         void next(int32_t value) {
             // store the value
             switch (current) {
+                case steps::automatic:
+                    // store if the calibration should be updated by 
+                    // the drift estimator
+                    drift::set_automatic<RtcPeriph>(static_cast<bool>(value));
+
+                    // continue to the manual calibration
+                    if (!static_cast<bool>(value)) {
+                        break;
+                    }
+
+                    // use the estimate we already have
+                    if (Drift::has_estimate()) {
+                        Drift::apply();
+                    }
+                    else if (drift::history<RtcPeriph>::has_estimate()) {
+                        drift::apply<RtcPeriph>(drift::history<RtcPeriph>::estimate());
+                    }
+
+                    // reset the states
+                    current = steps::automatic;
+
+                    // go back to the previous screen
+                    screen_base::buffer.back();
+                    return;
                 case steps::enabled:
                     // check if we need to enable the calibration
                     if (static_cast<bool>(value)) {
@@ -41,10 +99,10 @@ namespace menu {
                     }
 
                     // disable the calibration in the RTC
-                    RtcPeriph::port->CCR &= ~(0x1 << 4);
+                    RtcPeriph::port->CCR |= (0x1 << 4);
 
                     // reset the states
-                    current = steps::enabled;
+                    current = steps::automatic;
 
                     // go back to the previous screen
                     screen_base::buffer.back();
@@ -56,8 +114,9 @@ namespace menu {
                     // setup the calibration if we have any
                     RtcPeriph::port->CALIBRATION = (static_cast<uint32_t>(value) & 0x1ffff) | (direction << 17);
 
-                    // enable the rtc calibration
-                    RtcPeriph::port->CCR |= (0x1 << 4);
+                    // enable the rtc calibration. The calibration
+                    // counter runs when the bit is cleared
+                    RtcPeriph::port->CCR &= ~(0x1 << 4);
 
                     // go back one screen to the setings menu
                     screen_base::buffer.back();
@@ -75,7 +134,7 @@ namespace menu {
         }
  
         void cancel() {
-            if (current == steps::enabled) {
+            if (current == steps::automatic) {
                 // go back to the menu
                 screen_base::buffer.back();
 
@@ -92,9 +151,19 @@ namespace menu {
         void change_screen(const steps current) {
             // get what state we are in
             switch (current) {
+                case steps::automatic:
+                    // show the latest estimate in the title
+                    update_drift();
+
+                    str_popup.configure(
+                        drift_str, drift::is_automatic<RtcPeriph>(), 
+                        "auto", "manual", [&](bool value){next(value);},
+                        [&](){cancel();}
+                    );
+                    break;
                 case steps::enabled:
                     str_popup.configure(
-                        "RTC calibration", static_cast<bool>(RtcPeriph::port->CCR & (0x1 << 4)), 
+                        "RTC calibration", !static_cast<bool>(RtcPeriph::port->CCR & (0x1 << 4)), 
                         "enabled", "disabled", [&](bool value){next(value);},
                         [&](){cancel();}
                     );
@@ -127,7 +196,8 @@ namespace menu {
 
     public:
         calibration(numeric_popup<FrameBuffer>& num_popup, popup<FrameBuffer>& str_popup): 
-            current(steps::enabled), num_popup(num_popup), str_popup(str_popup)
+            current(steps::automatic), num_popup(num_popup), str_popup(str_popup),
+            drift_str{}
         {}
 
         virtual void main(const klib::time::us delta, const input::buttons& buttons) override {
@@ -135,7 +205,7 @@ namespace menu {
             // are only called from the settings menu. The
             // popup callbacks will skip this by changing 
             // directly to the new popup
-            current = steps::enabled;
+            current = steps::automatic;
 
             // show the first screen
             change_screen(current);
@@ -1,36 +1,27 @@
 #pragma once
 
+#include <array>
+#include <algorithm>
 #include <cstring>
 #include <optional>
 
 #include <klib/filesystem/virtual_fat.hpp>
-#include <klib/delay.hpp>
 #include <klib/string.hpp>
+#include <klib/io/systick.hpp>
 #include <klib/crypt/base32.hpp>
 
 #include "screen.hpp"
+#include "../spsc.hpp"
+#include "../crc.hpp"
+#include "../usb_switch.hpp"
 
 namespace menu::detail {
-    const char* strnstr(const char *haystack, const char *needle, size_t len) {
-        const size_t needle_len = klib::string::strlen(needle);
-
-        if (!needle_len) {
-            return haystack;
-        }
-
-        for (uint32_t i = 0; i <= (len - needle_len); i++) {
-            if ((haystack[0] == needle[0]) && (0 == std::strncmp(haystack, needle, needle_len))) {
-                return haystack;
-            }
-
-            haystack++;
-        }
-
-        return nullptr;
-    }
-
     class fat_helper {
     public:
+        // flag if the files cannot accept new data. Set when the
+        // sectors the host wrote are not processed yet
+        static inline volatile bool busy = false;
+
         // fat filesystem
         using filesystem = klib::filesystem::virtual_fat<fat_helper, 16, (static_cast<uint32_t>(1) * 1024 * 1024), 16, 1>;
 
@@ -97,7 +88,8 @@ namespace menu::detail {
          * @return false 
          */
         static bool ready() {
-            return true;
+            // tell the host to wait when we are still busy
+            return !busy;
         }
 
         /**
@@ -160,6 +152,9 @@ namespace menu::detail {
          * @return false 
          */
         static bool write(uint8_t *const data, const uint32_t address, const uint16_t size) {
+            // the host only writes when we are ready. The file 
+            // stores the sectors until the main loop parses them
+
             // change the address and size to sector sizes and give it to the virtual filesystem
             filesystem::write(address / filesystem::sector_size, data, size / filesystem::sector_size);
 
@@ -212,6 +207,9 @@ namespace menu {
                 digits_numeric_error,
                 key_error,
                 full_error,
+                overflow_error,
+                order_error,
+                rewrite_error,
             };
 
             // message result
@@ -221,8 +219,20 @@ namespace menu {
             char str[sizeof(storage::entry::str)];
         };
 
-        // array with all the messages we generated
-        static inline klib::dynamic_array<parse_t, Storage::max_entries> messages = {};
+        // max amount of messages we show. The oldest message is 
+        // dropped when we get more
+        constexpr static uint32_t max_messages = 32;
+
+        // messages the user can still see. Only used by the ui
+        static inline klib::dynamic_array<parse_t, max_messages> messages = {};
+
+        // max amount of messages that are not moved to the ui yet
+        constexpr static uint32_t max_results = 32;
+
+        // queue with the messages from the parser and the flash 
+        // operations to the ui. Both run from the main loop before
+        // the ui reads the queue
+        static inline spsc::queue<parse_t, max_results> results;
 
         /**
          * @brief Get the line length of a entry
@@ -256,6 +266,114 @@ namespace menu {
         // buffer to store a single line
         static inline klib::dynamic_array<char, FatHelper::filesystem::sector_size> buffer;
 
+        // max length of a single line of a entry
+        constexpr static uint32_t max_line_length = (
+            (sizeof(storage::entry::str) - 1) + 3 + 1 + (sizeof(", , , ***\r\n") - 1)
+        );
+
+        // the offsets are stored as 16 bit values. Make sure the 
+        // biggest file fits
+        static_assert(
+            ((sizeof(config_header) - 1) + (sizeof(config_end) - 1) + 
+            (Storage::max_entries * max_line_length)) <= 0xffff, 
+            "File does not fit in the offset table"
+        );
+
+        // start offset of every part of the file (the header, all 
+        // the entries and the end marker). The last offset is the
+        // size of the file
+        static inline std::array<uint16_t, Storage::max_entries + 3> offsets = {};
+
+        // amount of parts in the file
+        static inline uint32_t media_count = 0;
+
+        // version of the entries the offsets are created from
+        static inline uint32_t profiles_version = 0;
+
+        // cache of the last line we have read
+        static inline std::array<char, max_line_length + 1> line = {};
+        static inline uint32_t line_index = 0xffffffff;
+
+        /**
+         * @brief Get the snapshot of the entries the offsets are 
+         * created from. Only valid while the storage has not changed
+         * the entries twice after it
+         * 
+         * @return const Storage::snapshot& 
+         */
+        static const typename Storage::snapshot& profiles() {
+            return Storage::pin(profiles_version);
+        }
+
+        /**
+         * @brief Get the length of a part of the file
+         * 
+         * @param index 
+         * @return uint32_t 
+         */
+        static uint32_t get_media_length(const uint32_t index) {
+            if (index == 0) {
+                return sizeof(config_header) - 1;
+            }
+
+            if (index == (media_count - 1)) {
+                return sizeof(config_end) - 1;
+            }
+
+            return get_entry_length(profiles().get(index - 1));
+        }
+
+        /**
+         * @brief Get the data of a part of the file
+         * 
+         * @param index 
+         * @return const char* 
+         */
+        static const char* get_media(const uint32_t index) {
+            if (index == 0) {
+                return config_header;
+            }
+
+            if (index == (media_count - 1)) {
+                return config_end;
+            }
+
+            // only create the line when it is not in the cache. A 
+            // line can be split over multiple sectors
+            if (line_index != index) {
+                write_entry(profiles().get(index - 1), line.data());
+
+                line_index = index;
+            }
+
+            return line.data();
+        }
+
+        /**
+         * @brief Create the offsets of all the parts of the file. 
+         * Needs to be called after the entries have changed
+         * 
+         */
+        static void update_offsets() {
+            // use the same entries for the offsets and the lines
+            profiles_version = Storage::get_version();
+
+            // header + all the entries + end marker
+            media_count = profiles().size() + 2;
+
+            offsets[0] = 0;
+
+            for (uint32_t i = 0; i < media_count; i++) {
+                offsets[i + 1] = offsets[i] + get_media_length(i);
+            }
+
+            // the lines might have changed
+            line_index = 0xffffffff;
+        }
+
+        // amount of messages we had when we last drew the screen
+        uint32_t last_message_count = 0;
+
         /**
          * @brief Read file implementation
          * 
@@ -269,68 +387,41 @@ namespace menu {
                 return;
             }
 
+            // the storage reuses the snapshot of the offsets after 
+            // the entries changed twice. Create the offsets again 
+            // when the entries changed
+            if (Storage::get_version() != profiles_version) {
+                update_offsets();
+            }
+
             // amount of bytes we should write
             uint32_t bytes = sectors * FatHelper::filesystem::sector_size;
             uint32_t start_byte = (offset * FatHelper::filesystem::sector_size);
 
-            uint32_t current_byte = 0;
             uint32_t byte_offset = 0;
 
-            // get all the entries
-            const auto entries = Storage::get_entries();
+            // search for the part of the file with the first byte. The 
+            // offsets are sorted so we can do a binary search
+            const auto end = offsets.begin() + (media_count + 1);
+            uint32_t i = (std::upper_bound(offsets.begin(), end, start_byte) - offsets.begin()) - 1;
 
-            // check what media should handle the read
-            for (uint32_t i = 0; i < entries.size() + 2; i++) {
-                // get the amount of bytes for the current entry
-                const uint32_t entry_bytes = ((i == 0) ? (sizeof(config_header) - 1) : 
-                    ((i == (entries.size() + 1)) ? (sizeof(config_end) - 1) : get_entry_length(entries[i - 1]))
-                );
+            // copy all the parts until we have all the data
+            for (; (i < media_count) && bytes; i++) {
+                // get the offset in the current media
+                const uint32_t media_offset = start_byte - offsets[i];
 
-                // get the end of the current media
-                const uint32_t current_end = current_byte + entry_bytes;
-                
-                // check if the request is for the current media
-                if ((start_byte >= current_byte) && (start_byte < current_end)) {
-                    // get the offset in the current media
-                    const uint32_t media_offset = start_byte - current_byte;
+                // get the maximum amount we should read in the current media
+                const uint32_t count = klib::min(offsets[i + 1] - start_byte, bytes);
 
-                    // get the maximum amount we should read in the current media
-                    const uint32_t count = klib::min(current_end - start_byte, bytes);
+                // copy the data to the buffer we are sending to the host
+                std::copy_n(get_media(i) + media_offset, count, &data[byte_offset]);
 
-                    if (i == 0) {
-                        // copy the header into the buffer
-                        std::copy_n(config_header + media_offset, count, &data[byte_offset]);
-                    }
-                    else if (i == (entries.size() + 1)) {
-                        // copy the header into the buffer
-                        std::copy_n(config_end + media_offset, count, &data[byte_offset]);
-                    }
-                    else {
-                        // check if the entry fits in the buffer
-                        if (entry_bytes < buffer.max_size()) {
-                            // read the current entry into the buffer
-                            write_entry(entries[i - 1], buffer.data());
+                // update the sector and the amount of sectors we want to process
+                bytes -= count;
+                start_byte += count;
 
-                            // copy the data to the buffer we are sending to the host
-                            std::copy_n(buffer.data() + media_offset, count, &data[byte_offset]);
-                        }
-                    }
-
-                    // update the sector and the amount of sectors we want to process
-                    bytes -= count;
-                    start_byte += count;
-
-                    // move the offset we are in the ptr
-                    byte_offset += count;
-                }
-
-                // check if we have data left to process
-                if (!sectors) {
-                    return;
-                }
-
-                // move past the current media to go to the next one
-                current_byte += entry_bytes;
+                // move the offset we are in the ptr
+                byte_offset += count;
             }
         }
 
@@ -523,75 +614,568 @@ namespace menu {
             res.result = result;
             klib::string::strcpy(res.str, str);
             
-            // check if we have space in the message array
-            if (messages.size() < messages.max_size()) {
-                // write the message
-                messages.push_back(res);
+            // send the message to the ui. The message is dropped 
+            // when the ui is not keeping up
+            results.push(res);
+        }
+
+        /**
+         * @brief Move all the new messages to the messages the user 
+         * can see. Should only be called from the ui
+         * 
+         */
+        static void update_messages() {
+            while (!results.empty()) {
+                // make space by dropping the oldest message
+                if (messages.size() >= messages.max_size()) {
+                    std::copy(messages.begin() + 1, messages.end(), messages.begin());
+                    messages.pop_back();
+                }
+
+                messages.push_back(results.front());
+                results.pop();
             }
         }
 
         /**
-         * @brief Write file implementation. Only works if sectors are in order
+         * @brief Change to the storage that is written to flash 
+         * from the main loop
+         * 
+         */
+        struct operation {
+            /**
+             * @brief Available operations
+             * 
+             */
+            enum class type {
+                begin,
+                add,
+                remove,
+                commit
+            };
+
+            // operation to do
+            type op;
+
+            // index of the entry to remove
+            uint32_t index;
+
+            // entry to add
+            storage::entry entry;
+        };
+
+        // max amount of operations in the queue
+        constexpr static uint32_t max_operations = 8;
+
+        // queue with all the operations that still need to be done. 
+        // Stored in RAM1 as the main ram is limited. Not initialized
+        // on startup
+        static inline std::array<operation, max_operations> operations __attribute__ ((section(".ram1"))) = {};
+
+        // first operation in the queue and the amount of operations
+        static inline uint32_t operation_head = 0;
+        static inline volatile uint32_t operation_count = 0;
+
+        // amount of operations when we last drew the screen
+        uint32_t last_operation_count = 0;
+
+        /**
+         * @brief Run the first operation in the queue. Should only
+         * be called from the main loop. The flash is changed with 
+         * the interrupts enabled, the host is told to wait until we
+         * are done
+         * 
+         * @return true when a operation was done 
+         * @return false when the queue is empty 
+         */
+        static bool run_operation() {
+            if (!operation_count) {
+                return false;
+            }
+
+            // the file is read from the entries we are changing. 
+            // Let the host wait until we are done
+            FatHelper::busy = true;
+
+            const auto& o = operations[operation_head];
+
+            switch (o.op) {
+                case operation::type::begin:
+                    Storage::begin();
+                    break;
+                case operation::type::add:
+                    // add the entry and notify the user
+                    if (Storage::add(o.entry)) {
+                        write_result(o.entry.str, parse_t::new_entry);
+                    }
+                    else {
+                        write_result(o.entry.str, parse_t::full_error);
+                    }
+                    break;
+                case operation::type::remove:
+                    Storage::remove(o.index);
+                    break;
+                case operation::type::commit:
+                    Storage::commit();
+
+                    // the entries changed. Update the offsets for 
+                    // reading the file. A read the host started 
+                    // before we were busy can still use them
+                    klib::target::disable_irq();
+
+                    update_offsets();
+
+                    klib::target::enable_irq();
+                    break;
+            }
+
+            klib::target::disable_irq();
+
+            // remove the operation from the queue
+            operation_head = (operation_head + 1) % max_operations;
+            operation_count = operation_count - 1;
+
+            // accept new sectors again when we have space for them
+            FatHelper::busy = (received_count >= max_received);
+
+            klib::target::enable_irq();
+
+            return true;
+        }
+
+        /**
+         * @brief Add a operation to the queue. Runs the oldest 
+         * operation directly when the queue is full. Should only
+         * be called from the parser in the main loop. The usb side
+         * waits while the parser is busy
+         * 
+         * @param o 
+         */
+        static void push_operation(const operation& o) {
+            // make sure we have space in the queue
+            while (operation_count >= max_operations) {
+                run_operation();
+            }
+
+            klib::target::disable_irq();
+
+            operations[(operation_head + operation_count) % max_operations] = o;
+            operation_count = operation_count + 1;
+
+            klib::target::enable_irq();
+        }
+
+        // amount of sectors we can receive ahead of the sector we 
+        // are expecting. The data of the file is not kept anywhere 
+        // else so a sector further ahead aborts the upload. Update 
+        // the message of the order error when this changes
+        constexpr static uint32_t reorder_window = 4;
+
+        // marker for a sector slot without data
+        constexpr static uint32_t invalid_sector = 0xffffffff;
+
+        /**
+         * @brief Sector that was received before the sectors in 
+         * front of it
+         * 
+         */
+        struct staged_sector {
+            // offset of the sector in the file
+            uint32_t offset;
+
+            // time we received the sector
+            klib::time::ms time;
+
+            // data of the sector
+            std::array<uint8_t, FatHelper::filesystem::sector_size> data;
+        };
+
+        // sectors that are received out of order. Stored in RAM1 as
+        // the main ram is limited. Cleared when the screen activates
+        static inline std::array<staged_sector, reorder_window> staged __attribute__ ((section(".ram1"))) = {};
+
+        // next sector we are expecting. Reset when we are at offset 0
+        // and invalid when we do not have a upload in progress
+        static inline uint32_t next_sector = invalid_sector;
+
+        // max amount of sectors in the file we keep a checksum for
+        constexpr static uint32_t max_sectors = (
+            (0xffff + FatHelper::filesystem::sector_size - 1) / FatHelper::filesystem::sector_size
+        );
+
+        // checksum of every sector we parsed in the current upload 
+        // and the amount of sectors we parsed. Used to detect when 
+        // the host writes a sector again
+        static inline std::array<uint16_t, max_sectors> parsed_crc = {};
+        static inline uint32_t parsed_count = 0;
+
+        // time after the last write before we show the upload is 
+        // incomplete
+        constexpr static klib::time::ms stall_time = 5'000;
+
+        // last time the host wrote a sector of the file
+        static inline klib::time::ms last_sector_time = {};
+
+        // flag if the upload was stalled when we last drew the screen
+        bool last_stalled = false;
+
+        // flag if the last upload failed. Cleared when the host 
+        // writes the start of the file again
+        static inline bool failed = false;
+
+        // flag if we found the csv header in the file
+        static inline bool header_found = false;
+
+        // all the entries that are still valid after the write
+        static inline std::array<bool, Storage::max_entries> valid_entries = {};
+
+        /**
+         * @brief Sector written by the host that is not parsed yet
+         * 
+         */
+        struct received_sector {
+            // offset of the sector in the file
+            uint32_t offset;
+
+            // data of the sector
+            std::array<uint8_t, FatHelper::filesystem::sector_size> data;
+        };
+
+        // amount of sectors we can receive before they are parsed
+        constexpr static uint32_t max_received = 4;
+
+        // ring buffer with the sectors that still need to be parsed. 
+        // Stored in RAM1 as the main ram is limited. Not initialized
+        // on startup
+        static inline std::array<received_sector, max_received> received __attribute__ ((section(".ram1"))) = {};
+
+        // first sector in the ring buffer and the amount of sectors
+        static inline uint32_t received_head = 0;
+        static inline volatile uint32_t received_count = 0;
+
+        // flag if we had to drop a sector because the ring buffer 
+        // was full. Only happens when the host ignores the busy flag
+        static inline volatile bool overflow = false;
+
+        /**
+         * @brief Write file implementation. Only copies the sectors
+         * into the ring buffer. The sectors are parsed from the main
+         * loop
          * 
          * @param offset 
          * @param data 
          * @param sectors 
          */
         static void write_config(const uint32_t offset, const uint8_t *const data, const uint32_t sectors) {
-            // next sector we are expecting. Reset when we are at offset 0
-            static uint32_t next_sector = 0;
+            for (uint32_t i = 0; i < sectors; i++) {
+                // check if we have space for the sector. The host 
+                // should have waited until we were ready
+                if (received_count >= max_received) {
+                    // we cannot store the sector. Let the main loop 
+                    // know the upload is incomplete
+                    overflow = true;
 
-            // all the entries that are still valid after the write
-            static std::array<bool, Storage::max_entries> valid_entries = {};
+                    continue;
+                }
 
-            // byte index we are at
-            uint32_t index = 0;
+                // copy the sector into the ring buffer
+                auto& r = received[(received_head + received_count) % max_received];
 
-            // remove the comment and the csv header from our input
-            if (!offset) {
-                next_sector = sectors;
+                r.offset = offset + i;
+                std::copy_n(
+                    data + (i * FatHelper::filesystem::sector_size), 
+                    FatHelper::filesystem::sector_size, r.data.begin()
+                );
 
-                // clear all the valid entries
-                valid_entries = {};
+                received_count = received_count + 1;
+            }
 
-                // search for the csv header
-                const uint8_t* res = reinterpret_cast<const uint8_t*>(
-                    detail::strnstr(
-                        reinterpret_cast<const char*>(data), config_csv,
-                        sectors * FatHelper::filesystem::sector_size
-                    )
-                );
+            // tell the host to wait when we are full. The sectors 
+            // are parsed from the main loop. The main loop clears
+            // the flag when it is done
+            if (received_count >= max_received) {
+                FatHelper::busy = true;
+            }
+        }
 
-                // check if we found the string
-                if (res == nullptr) {
-                    return;
+        /**
+         * @brief Parse the first sector in the ring buffer. Should
+         * only be called from the main loop
+         * 
+         * @return true when a sector was parsed 
+         * @return false when the ring buffer is empty 
+         */
+        static bool parse_received() {
+            if (!received_count) {
+                return false;
+            }
+
+            // parse the sector. The usb side only adds sectors after
+            // the last one so the first sector does not change
+            const auto& r = received[received_head];
+            write_sector(r.offset, r.data.data());
+
+            // check if we missed any sectors. Do not save anything
+            // until the host writes the file again
+            if (overflow) {
+                overflow = false;
+
+                abort_upload(parse_t::overflow_error);
+            }
+
+            // remove the sector from the ring buffer
+            klib::target::disable_irq();
+
+            received_head = (received_head + 1) % max_received;
+            received_count = received_count - 1;
+
+            // we have space again
+            FatHelper::busy = false;
+
+            klib::target::enable_irq();
+
+            return true;
+        }
+
+        /**
+         * @brief Get the checksum of a sector. The lower half of the
+         * crc32 is enough to detect a sector that changed
+         * 
+         * @param data 
+         * @return uint16_t 
+         */
+        static uint16_t sector_crc(const uint8_t *const data) {
+            return static_cast<uint16_t>(crc::crc32(data, FatHelper::filesystem::sector_size));
+        }
+
+        /**
+         * @brief Start a new upload of the file
+         * 
+         */
+        static void begin_upload() {
+            // clear all the valid entries
+            valid_entries = {};
+
+            // the host might have written some sectors of the file 
+            // before the start. Sectors from before the last write 
+            // burst are left over from a upload that never started
+            for (auto& s: staged) {
+                if ((last_sector_time - s.time) > stall_time) {
+                    s.offset = invalid_sector;
                 }
+            }
 
-                // clear any old data left in the buffer
-                buffer.clear();
+            // clear any old data left in the buffer
+            buffer.clear();
+            header_found = false;
+            parsed_count = 0;
+            failed = false;
 
-                // move the index
-                index += ((res + (sizeof(config_csv) - 1)) - data);
+            // the parser needs the entries after the previous
+            // upload. Finish everything that is still queued
+            while (run_operation()) {
+                // keep running
             }
-            else {
-                // check if we are doing a out of order sector write. We do not support that
-                if (offset != next_sector) {
-                    // mark as invalid and do nothing until we get a new start
-                    next_sector = 0xffffffff;
 
+            // start a new transaction in the storage
+            push_operation({operation::type::begin});
+
+            next_sector = 0;
+        }
+
+        /**
+         * @brief Clear the upload and all the staged sectors
+         * 
+         */
+        static void clear_upload() {
+            next_sector = invalid_sector;
+            parsed_count = 0;
+
+            for (auto& s: staged) {
+                s.offset = invalid_sector;
+            }
+        }
+
+        /**
+         * @brief Stop the current upload without saving anything 
+         * and notify the user
+         * 
+         * @param result 
+         */
+        static void abort_upload(const parse_t::result_t result) {
+            // the transaction is never committed. The storage drops
+            // it on the next begin
+            clear_upload();
+
+            // only notify the user once. The rest of the sectors of
+            // the upload are dropped without a message
+            failed = true;
+
+            write_result("CONFIG.TXT", result);
+        }
+
+        /**
+         * @brief Stage a sector that is received before the sectors
+         * in front of it
+         * 
+         * @param offset 
+         * @param expected 
+         * @param data 
+         * @return true when the sector is staged 
+         * @return false when the sector is outside the window or we 
+         * have no space
+         */
+        static bool stage_sector(const uint32_t offset, const uint32_t expected, const uint8_t *const data) {
+            if ((offset < expected) || (offset >= (expected + reorder_window))) {
+                return false;
+            }
+
+            // overwrite the sector if we already have it
+            staged_sector* slot = nullptr;
+
+            for (auto& s: staged) {
+                if (s.offset == offset) {
+                    slot = &s;
+
+                    break;
+                }
+
+                if ((slot == nullptr) && (s.offset == invalid_sector)) {
+                    slot = &s;
+                }
+            }
+
+            if (slot == nullptr) {
+                return false;
+            }
+
+            slot->offset = offset;
+            slot->time = last_sector_time;
+            std::copy_n(data, slot->data.size(), slot->data.data());
+
+            return true;
+        }
+
+        /**
+         * @brief Returns if a upload is waiting for sectors the host
+         * has not written yet
+         * 
+         * @return true 
+         * @return false 
+         */
+        static bool is_stalled() {
+            // check if we are waiting for anything
+            bool waiting = (next_sector != invalid_sector);
+
+            for (const auto& s: staged) {
+                waiting = waiting || (s.offset != invalid_sector);
+            }
+
+            if (!waiting) {
+                return false;
+            }
+
+            // the host normally writes the whole file at once
+            return (klib::io::systick<>::get_runtime() - last_sector_time) > stall_time;
+        }
+
+        /**
+         * @brief Handle a single sector of the file. Sectors that
+         * are received out of order are staged until the sectors in
+         * front of them are received
+         * 
+         * @param offset 
+         * @param data 
+         */
+        static void write_sector(const uint32_t offset, const uint8_t *const data) {
+            // mark the host is still writing
+            last_sector_time = klib::io::systick<>::get_runtime();
+
+            // check if the host writes a sector of the current upload
+            // we already parsed
+            if ((next_sector != invalid_sector) && (offset < parsed_count)) {
+                // the same data is written again when the host retries
+                // a write. Sectors we do not have a checksum for are 
+                // treated the same
+                if ((offset >= parsed_crc.size()) || (parsed_crc[offset] == sector_crc(data))) {
                     return;
                 }
-                else {
-                    // we have a valid sector. Move the next sector
-                    next_sector += sectors;
+
+                // a sector we parsed changed during the upload. We 
+                // cannot parse it again without the sectors after it.
+                // A new start of the file restarts the upload
+                if (offset) {
+                    abort_upload(parse_t::rewrite_error);
+
+                    return;
+                }
+            }
+
+            // a write at the start of the file starts a new upload
+            if (!offset) {
+                begin_upload();
+            }
+
+            // get the sector we need next. Without a upload this is
+            // the start of the file
+            const uint32_t expected = (next_sector == invalid_sector) ? 0 : next_sector;
+
+            // check if we received the sector too early
+            if (offset != expected) {
+                // stage the sector until we have the sectors in 
+                // front of it
+                if (!stage_sector(offset, expected, data) && !failed) {
+                    // we cannot keep the sector. Do nothing until 
+                    // the host writes the file again
+                    abort_upload(parse_t::order_error);
                 }
+
+                return;
             }
 
-            // get all the entries
-            auto& entries = Storage::get_entries();
+            // parse the sector we expected
+            parse_sector(data);
+
+            // parse all the staged sectors that are next
+            bool found = true;
+
+            while (found && (next_sector != invalid_sector)) {
+                found = false;
+
+                for (auto& s: staged) {
+                    if (s.offset != next_sector) {
+                        continue;
+                    }
+
+                    s.offset = invalid_sector;
+                    found = true;
+
+                    parse_sector(s.data.data());
+
+                    break;
+                }
+            }
+        }
+
+        /**
+         * @brief Parse a sector of the file. Sectors should be parsed
+         * in order
+         * 
+         * @param data 
+         */
+        static void parse_sector(const uint8_t *const data) {
+            // store the checksum to detect when the host writes the
+            // sector again
+            if (next_sector < parsed_crc.size()) {
+                parsed_crc[next_sector] = sector_crc(data);
+            }
+
+            // move to the next sector
+            next_sector++;
+            parsed_count = next_sector;
 
             // push every byte we have until a newline
-            for (; index < sectors * FatHelper::filesystem::sector_size; index++) {
+            for (uint32_t index = 0; index < FatHelper::filesystem::sector_size; index++) {
                 // check if we have a newline character
                 if (data[index] != '\r' && data[index] != '\n') {
                     // make sure we have enough data in the buffer
@@ -611,26 +1195,47 @@ namespace menu {
                     continue;
                 }
 
+                // skip everything until we have the csv header (we remove
+                // the null terminator + \r\n)
+                if (!header_found) {
+                    header_found = (
+                        (buffer.size() == (sizeof(config_csv) - 3)) && 
+                        (std::strncmp(buffer.data(), config_csv, (sizeof(config_csv) - 3)) == 0)
+                    );
+
+                    buffer.clear();
+
+                    continue;
+                }
+
                 // check for the end of file (we remove the null terminator + \r\n)
                 if (std::strncmp(buffer.data(), config_end, (sizeof(config_end) - 3)) == 0) {
-                    // we are at the end of the file. Mark as done
-                    next_sector = 0xffffffff;
+                    // we are at the end of the file. Mark as done. 
+                    // Anything staged after the end is not part of
+                    // the file
+                    next_sector = invalid_sector;
+
+                    for (auto& s: staged) {
+                        s.offset = invalid_sector;
+                    }
 
-                    // delete all the entries that are not valid starting from the back
-                    for (uint32_t i = entries.size(); i > 0; i--) {
-                        if (valid_entries[i - 1]) {
+                    // delete all the entries that are not valid
+                    const auto& entries = Storage::pin();
+
+                    for (uint32_t i = 0; i < entries.size(); i++) {
+                        if (valid_entries[i]) {
                             continue;
                         }
 
                         // notify the user we removed the entry
-                        write_result(entries[i - 1].str, parse_t::deleted_entry);
+                        write_result(entries.get(i).str, parse_t::deleted_entry);
 
                         // erase the current entry
-                        entries.erase(&entries[i - 1]);
+                        push_operation({operation::type::remove, i});
                     }
 
-                    // write the buffer to memory
-                    Storage::write();
+                    // write the changes to memory
+                    push_operation({operation::type::commit});
 
                     return;
                 }
@@ -740,33 +1345,18 @@ namespace menu {
 
                 // add the entry if we dont have it already
                 if (res == parse_result::valid) {
-                    const uint32_t size = entries.size();
-
-                    if (size >= entries.max_size()) {
-                        // write the error
-                        write_result(ret.str, parse_t::full_error);
-
-                        // buffer is full. Do not write to it
-                        buffer.clear();
-
-                        continue;
-                    }
-
-                    // mark the entry as valid
-                    valid_entries[size] = true;
-
-                    // add our entry to the entries
-                    entries.push_back(ret);
-
-                    // write the result
-                    write_result(ret.str, parse_t::new_entry);
+                    // add our entry to the storage. The result is
+                    // written when the entry is added
+                    push_operation({operation::type::add, 0, ret});
                 }
                 else if (res == parse_result::unchanged) {
                     bool found = false;
 
                     // search what entry this is
+                    const auto& entries = Storage::pin();
+
                     for (uint32_t i = 0; i < entries.size(); i++) {
-                        if (std::strncmp(entries[i].str, ret.str, sizeof(storage::entry::str) - 1) != 0) {
+                        if (std::strncmp(entries.get(i).str, ret.str, sizeof(storage::entry::str) - 1) != 0) {
                             continue;
                         }
 
@@ -799,50 +1389,45 @@ namespace menu {
         config() {}
 
         virtual void activate(const screen_id id) override {
-            // disconnect the usb keyboard from the host
-            // this prevents a blue screen when we suddenly
-            // change to a different usb type
-            UsbKeyboard::disconnect();
-
-            // wait a bit to give the host time to detect it
-            klib::delay<>(klib::time::ms(500));
+            // switch from the usb keyboard to the usb mass storage. 
+            // The mass storage is connected from the main loop after
+            // the filesystem is ready
+            usb::switcher::begin<UsbKeyboard, UsbMassStorage>();
 
             // clear the messages array
             messages.clear();
+            results.clear();
+
+            // start without a upload in progress
+            clear_upload();
 
             // initialize the filesystem
             FatHelper::filesystem::init("KLIB");
 
-            // get the size of the file
-            const auto entries = Storage::get_entries();
-            uint32_t length = 0;
-
-            for (const auto& entry : entries) {
-                // increment the length for the total file size
-                length += get_entry_length(entry);
-            }
-
-            // add the header size
-            length += (sizeof(config_header) - 1) + (sizeof(config_end) - 1);
+            // get the offsets of all the parts of the file. The last
+            // offset is the size of the file
+            update_offsets();
 
             // create a readme file
-            FatHelper::filesystem::create_file("CONFIG  TXT", length, read_config, write_config);  
-            
-            // initialize the usb mass storage
-            UsbMassStorage::init();
+            FatHelper::filesystem::create_file("CONFIG  TXT", offsets[media_count], read_config, write_config);  
         }
 
         virtual void deactivate(const screen_id id) override {
-            // disconnect the usb mass storage from the host
-            // this prevents a blue screen when we suddenly
-            // change to a different usb type
-            UsbMassStorage::disconnect();
+            // parse everything the host wrote before we leave the 
+            // usb mode
+            while (parse_received()) {
+                // keep running
+            }
 
-            // wait a bit to give the host time to detect it
-            klib::delay<>(klib::time::ms(500));
+            // make sure all the changes are written to flash before 
+            // we leave the usb mode
+            while (run_operation()) {
+                // keep running
+            }
 
-            // initialize the usb mass storage
-            UsbKeyboard::init();
+            // switch back to the usb keyboard. The keyboard is 
+            // connected from the main loop
+            usb::switcher::begin<UsbMassStorage, UsbKeyboard>();
         }
 
         virtual void main(const klib::time::us delta, const input::buttons& buttons) override {
@@ -851,20 +1436,68 @@ namespace menu {
                 screen_base::buffer.back();
             }
             else if (buttons.enter == input::state::pressed) {
-                // remove a message if we have one
+                // remove the last message we got
                 if (!messages.empty()) {
-                    // disable the interrupts while we remove something 
-                    // from the array
-                    klib::target::disable_irq();
-
-                    // remove the last message we got
                     messages.pop_back();
-
-                    // enable the interrupts again after we have removed 
-                    // it
-                    klib::target::enable_irq();
                 }
             }
+
+            // get the new messages from the parser
+            update_messages();
+
+            // redraw the screen when the amount of messages changed
+            if (messages.size() != last_message_count) {
+                last_message_count = messages.size();
+
+                screen_base::invalidate();
+            }
+
+            // redraw the progress when we have written something
+            if (operation_count != last_operation_count) {
+                last_operation_count = operation_count;
+
+                screen_base::invalidate();
+            }
+
+            // show when the host stopped writing in the middle of 
+            // the file
+            const bool stalled = is_stalled();
+
+            if (stalled != last_stalled) {
+                last_stalled = stalled;
+
+                screen_base::invalidate();
+            }
+        }
+
+        virtual bool idle() override {
+            // parse a sector the host wrote. Flash changes are 
+            // done on the next call
+            if (parse_received()) {
+                // get the messages of the sector so the queue does 
+                // not fill up
+                update_messages();
+
+                return true;
+            }
+
+            // write a single change to flash. The usb interrupt 
+            // keeps running, the host waits until we are done
+            run_operation();
+
+            // check if we have more work to do
+            const bool pending = operation_count;
+
+            // get the result of the operation
+            update_messages();
+
+            return pending;
+        }
+
+        virtual klib::time::us next_frame() override {
+            // messages are added by the usb side. Poll for new 
+            // messages a few times per second
+            return static_cast<klib::time::us>(klib::time::ms(100));
         }
 
         virtual void draw(FrameBuffer& frame_buffer, const klib::vector2u& offset) override {
@@ -890,6 +1523,49 @@ namespace menu {
                 klib::graphics::white
             );
 
+            // show we are still connecting to the host
+            if (usb::switcher::busy()) {
+                constexpr static char connecting[] = "Connecting...";
+
+                screen_base::small_text::template draw<FrameBuffer>(
+                    frame_buffer, connecting, 
+                    klib::vector2i{
+                        (240 - static_cast<int32_t>((sizeof(connecting) - 1) * screen_base::small_text::font::width)) / 2, 
+                        static_cast<int32_t>(135 - screen_base::small_text::font::height - 3)
+                    } - offset.cast<int32_t>(), 
+                    klib::graphics::white
+                );
+            }
+            else if (operation_count || last_stalled) {
+                // show the progress while we are writing to flash. 
+                // Buffer with the amount of changes left
+                char progress[32] = "Saving: ";
+
+                if (operation_count) {
+                    klib::string::itoa(operation_count, progress + klib::string::strlen(progress));
+                    klib::string::strcat(progress, " left");
+                }
+                else {
+                    // the host stopped writing before the end of the 
+                    // file. Show the sector we are waiting for
+                    klib::string::strcpy(progress, "Waiting for sector ");
+                    klib::string::itoa(
+                        (next_sector == invalid_sector) ? 0 : next_sector, 
+                        progress + klib::string::strlen(progress)
+                    );
+                }
+
+                // draw the progress at the bottom of the screen
+                screen_base::small_text::template draw<FrameBuffer>(
+                    frame_buffer, progress, 
+                    klib::vector2i{
+                        (240 - static_cast<int32_t>(klib::string::strlen(progress) * screen_base::small_text::font::width)) / 2, 
+                        static_cast<int32_t>(135 - screen_base::small_text::font::height - 3)
+                    } - offset.cast<int32_t>(), 
+                    klib::graphics::white
+                );
+            }
+
             // do not continue if we have no messages
             if (!has_message) {
                 return;
@@ -930,6 +1606,15 @@ namespace menu {
                 case parse_t::full_error:
                     klib::string::strcpy(message, "Could not add any more\nprofiles (no space)\n");
                     break;
+                case parse_t::overflow_error:
+                    klib::string::strcpy(message, "File written too fast\nchanges are not saved\nplease try again\n");
+                    break;
+                case parse_t::order_error:
+                    klib::string::strcpy(message, "File written >2KB out of\norder, changes not saved\nplease try again\n");
+                    break;
+                case parse_t::rewrite_error:
+                    klib::string::strcpy(message, "File changed while saving\nchanges are not saved\nplease try again\n");
+                    break;
                 default:
                     // unknown message. Skip
                     break;
@@ -3,10 +3,10 @@
 #include <cstring>
 #include <optional>
 
-#include <klib/delay.hpp>
 #include <klib/string.hpp>
 
 #include "screen.hpp"
+#include "../usb_switch.hpp"
 
 namespace menu {
     template <
@@ -27,29 +27,15 @@ namespace menu {
             // clear the last time we updated
             last_update = {};
 
-            // disconnect the usb keyboard from the host
-            // this prevents a blue screen when we suddenly
-            // change to a different usb type
-            UsbKeyboard::disconnect();
-
-            // wait a bit to give the host time to detect it
-            klib::delay<>(klib::time::ms(500));
-            
-            // initialize the usb mass storage
-            UsbMouse::init();
+            // switch from the usb keyboard to the usb mouse. The 
+            // mouse is connected from the main loop
+            usb::switcher::begin<UsbKeyboard, UsbMouse>();
         }
 
         virtual void deactivate(const screen_id id) override {
-            // disconnect the usb mass storage from the host
-            // this prevents a blue screen when we suddenly
-            // change to a different usb type
-            UsbMouse::disconnect();
-
-            // wait a bit to give the host time to detect it
-            klib::delay<>(klib::time::ms(500));
-
-            // initialize the usb mass storage
-            UsbKeyboard::init();
+            // switch back to the usb keyboard. The keyboard is 
+            // connected from the main loop
+            usb::switcher::begin<UsbMouse, UsbKeyboard>();
         }
 
         virtual void main(const klib::time::us delta, const input::buttons& buttons) override {
@@ -74,6 +60,11 @@ namespace menu {
             }
         }
 
+        virtual klib::time::us next_frame() override {
+            // wake up when we need to move the mouse again
+            return static_cast<klib::time::us>(klib::time::s(10)) - last_update;
+        }
+
         virtual void draw(FrameBuffer& frame_buffer, const klib::vector2u& offset) override {
             // clear the background black
             frame_buffer.clear(klib::graphics::black);
@@ -85,6 +76,20 @@ namespace menu {
                 klib::vector2i{36, 60} - offset.cast<int32_t>(), 
                 klib::graphics::white
             );
+
+            // show we are still connecting to the host
+            if (usb::switcher::busy()) {
+                constexpr static char connecting[] = "Connecting...";
+
+                screen_base::small_text::template draw<FrameBuffer>(
+                    frame_buffer, connecting, 
+                    klib::vector2i{
+                        (240 - static_cast<int32_t>((sizeof(connecting) - 1) * screen_base::small_text::font::width)) / 2, 
+                        static_cast<int32_t>(135 - screen_base::small_text::font::height - 3)
+                    } - offset.cast<int32_t>(), 
+                    klib::graphics::white
+                );
+            }
         }
     };
 }
\ No newline at end of file
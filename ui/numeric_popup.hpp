@@ -26,10 +26,35 @@ namespace menu {
         klib::vector2i range;
         int32_t value;
 
+        // auto repeat of the up and down buttons. The max step is
+        // set from the range in configure
+        input::repeat up_repeat;
+        input::repeat down_repeat;
+
+        /**
+         * @brief Move the value. Wraps around at the end of the 
+         * range
+         * 
+         * @param amount 
+         */
+        void move(const int32_t amount) {
+            const int32_t size = (range.y - range.x) + 1;
+
+            // get the offset in the range and wrap it around
+            int32_t offset = ((value - range.x) + amount) % size;
+
+            if (offset < 0) {
+                offset += size;
+            }
+
+            value = range.x + offset;
+        }
+
     public:
         numeric_popup(): 
             next(nullptr), cancel(nullptr), str(nullptr), 
-            max_length(0), range{}, value(0)
+            max_length(0), range{}, value(0), 
+            up_repeat(1), down_repeat(1)
         {}
 
         /**
@@ -50,6 +75,17 @@ namespace menu {
             this->value = value;
             this->range = {min, max};
 
+            // limit a single step while repeating to a tenth of the 
+            // range. A bigger step wraps around and skips most of the
+            // values of a small range. This also stops the repeat of 
+            // a previous popup
+            const uint32_t max_step = klib::max(
+                static_cast<uint32_t>((max - min) + 1) / 10, static_cast<uint32_t>(1)
+            );
+
+            up_repeat = input::repeat(max_step);
+            down_repeat = input::repeat(max_step);
+
             this->max_length = klib::max(
                 klib::string::detail::count_chars(min),
                 klib::string::detail::count_chars(max)
@@ -58,13 +94,12 @@ namespace menu {
             // update the callbacks
             this->next = next;
             this->cancel = cancel;
+
+            // redraw the popup with the new content
+            screen_base::invalidate();
         }
 
         virtual void main(const klib::time::us delta, const input::buttons& buttons) override {
-            // flag if we are doing a long press on up or down
-            static bool long_press_up = false;
-            static bool long_press_down = false;
-
             // check what button is pressed
             if (buttons.enter == input::state::pressed) {
                 // before we do anything go back to the previous item
@@ -88,39 +123,26 @@ namespace menu {
                     cancel();
                 }
             }
-            else if ((buttons.down == input::state::released) || (buttons.up == input::state::released)) {
-                // stop incrementing/decrementing the numbers
-                long_press_up = false;
-                long_press_down = false;
-            }
-            else if (input::is_pressed(buttons.down) || long_press_down) {
-                if (buttons.down == input::state::long_pressed) {
-                    long_press_down = true;
-                }
-
-                // the down button is pressed
-                if (value <= range.x) {
-                    // set to max value in range
-                    value = range.y;
-                }
-                else {
-                    value--;
+            else {
+                // get how much the buttons move the value. The
+                // longer a button is held the faster it goes
+                const int32_t amount = (
+                    static_cast<int32_t>(up_repeat.update(buttons.up, delta)) - 
+                    static_cast<int32_t>(down_repeat.update(buttons.down, delta))
+                );
+
+                if (amount) {
+                    move(amount);
+
+                    // redraw the new value
+                    screen_base::invalidate();
                 }
             }
-            else if (input::is_pressed(buttons.up) || long_press_up) {
-                if (buttons.up == input::state::long_pressed) {
-                    long_press_up = true;
-                }
+        }
 
-                // the up button is pressed
-                if (value >= range.y) {
-                    // set to max value in range
-                    value = range.x;
-                }
-                else {
-                    value++;
-                }
-            }
+        virtual klib::time::us next_frame() override {
+            // wake up for the next step while we are repeating
+            return klib::min(up_repeat.next_step(), down_repeat.next_step());
         }
 
         virtual void draw(FrameBuffer& frame_buffer, const klib::vector2u& offset) override {
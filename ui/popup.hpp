@@ -61,6 +61,9 @@ namespace menu {
             // update the callbacks
             this->next = next;
             this->cancel = cancel;
+
+            // redraw the popup with the new content
+            screen_base::invalidate();
         }
 
         virtual void main(const klib::time::us delta, const input::buttons& buttons) override {
@@ -90,6 +93,9 @@ namespace menu {
             else if (input::is_pressed(buttons.down) || input::is_pressed(buttons.up)) {
                 // the down button is pressed
                 value ^= true;
+
+                // redraw the new value
+                screen_base::invalidate();
             }
         }
 
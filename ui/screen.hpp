@@ -3,6 +3,7 @@
 #include <cstdint>
 
 #include <klib/dynamic_array.hpp>
+#include <klib/math.hpp>
 #include <klib/graphics/string.hpp>
 #include <klib/units.hpp>
 
@@ -70,6 +71,32 @@ namespace menu {
         }
     };
 
+    /**
+     * @brief Region on the screen that needs to be redrawn
+     * 
+     */
+    struct damage {
+        // top left of the region (inclusive)
+        klib::vector2i start;
+
+        // bottom right of the region (exclusive)
+        klib::vector2i end;
+
+        /**
+         * @brief Returns if the region overlaps with the
+         * provided region
+         * 
+         * @param start 
+         * @param end 
+         * @return true 
+         * @return false 
+         */
+        constexpr bool overlaps(const klib::vector2i& start, const klib::vector2i& end) const {
+            return (this->start.x < end.x) && (start.x < this->end.x) &&
+                (this->start.y < end.y) && (start.y < this->end.y);
+        }
+    };
+
     /**
      * @brief A screen we can draw on the screen
      * 
@@ -81,10 +108,18 @@ namespace menu {
         using small_font = klib::graphics::ascii_font_8x8;
         using large_font = klib::graphics::ascii_font_16x16;
 
+        // all the regions that changed since the last frame. When
+        // we run out of space the regions are merged into one
+        klib::dynamic_array<damage, 4> damaged = {};
+
     protected:
         // Screen queue. Allows up for 8 screens deep
         static inline screen_buffer<8> buffer = {};
 
+        // time returned by next_frame when the screen only 
+        // changes after a button press
+        constexpr static klib::time::us on_input = 0xffffffff;
+
         // small text for in the screens
         using small_text = klib::graphics::string<small_font>;
 
@@ -130,6 +165,82 @@ namespace menu {
             return buffer.get();
         }
 
+        /**
+         * @brief Mark a region of the screen as changed. Only the parts
+         * of the screen that are marked are redrawn and sent to the
+         * display
+         * 
+         * @param start 
+         * @param end 
+         */
+        void invalidate(const klib::vector2i start, const klib::vector2i end) {
+            // check if we still have space for a new region
+            if (damaged.size() < damaged.max_size()) {
+                damaged.push_back({start, end});
+
+                return;
+            }
+
+            // no space left. Grow the first region to cover all the
+            // regions and the new one
+            damage& d = damaged[0];
+
+            for (uint32_t i = 1; i < damaged.size(); i++) {
+                d.start = {klib::min(d.start.x, damaged[i].start.x), klib::min(d.start.y, damaged[i].start.y)};
+                d.end = {klib::max(d.end.x, damaged[i].end.x), klib::max(d.end.y, damaged[i].end.y)};
+            }
+
+            d.start = {klib::min(d.start.x, start.x), klib::min(d.start.y, start.y)};
+            d.end = {klib::max(d.end.x, end.x), klib::max(d.end.y, end.y)};
+
+            // remove everything except the merged region
+            while (damaged.size() > 1) {
+                damaged.pop_back();
+            }
+        }
+
+        /**
+         * @brief Mark the whole screen as changed
+         * 
+         */
+        void invalidate() {
+            // replace all the regions with a single region that
+            // covers everything
+            damaged.clear();
+            damaged.push_back({
+                klib::vector2i{0, 0},
+                klib::vector2i{INT32_MAX, INT32_MAX}
+            });
+        }
+
+        /**
+         * @brief Returns if anything changed in the region since the
+         * last frame
+         * 
+         * @param start 
+         * @param end 
+         * @return true 
+         * @return false 
+         */
+        bool is_damaged(const klib::vector2i start, const klib::vector2i end) const {
+            for (const auto& d: damaged) {
+                if (d.overlaps(start, end)) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /**
+         * @brief Clear all the changed regions. Called after the
+         * screen is written to the display
+         * 
+         */
+        void clear_damage() {
+            damaged.clear();
+        }
+
         /**
          * @brief Draw the current screen to the screen at offset.
          * 
@@ -155,6 +266,30 @@ namespace menu {
          */
         virtual void main(const klib::time::us delta, const input::buttons& buttons) {}
 
+        /**
+         * @brief Called while the main loop is waiting for the next
+         * frame. Should only do a small amount of background work 
+         * at the time
+         * 
+         * @return true when there is more work to do 
+         * @return false when the main loop can sleep 
+         */
+        virtual bool idle() {
+            return false;
+        }
+
+        /**
+         * @brief Returns the time until the screen needs to run again. 
+         * The main loop sleeps until this time has passed or until a 
+         * button is pressed
+         * 
+         * @return klib::time::us 
+         */
+        virtual klib::time::us next_frame() {
+            // by default we only change on a button press
+            return on_input;
+        }
+
         /**
          * @brief Called when the screen gets deactivated
          * 
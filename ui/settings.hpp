@@ -27,6 +27,10 @@ namespace menu {
 
         item selection;
 
+        // auto repeat of the up and down buttons
+        input::repeat up_repeat;
+        input::repeat down_repeat;
+
         // amount of labels
         constexpr static auto label_count = static_cast<uint8_t>(item::count);
 
@@ -48,6 +52,12 @@ namespace menu {
             selection(item::config)
         {}
 
+        virtual void activate(const screen_id id) override {
+            // do not continue a repeat from before we left
+            up_repeat.stop();
+            down_repeat.stop();
+        }
+
         virtual void main(const klib::time::us delta, const input::buttons& buttons) override {
             // check what button is pressed
             if (buttons.enter == input::state::pressed) {
@@ -74,27 +84,31 @@ namespace menu {
                 // go back if we have a long press
                 screen_base::buffer.back();
             }
-            else if (input::is_pressed(buttons.down)) {
-                // the down button is pressed
-                selection = static_cast<item>(
-                    (static_cast<uint8_t>(selection) + 1
-                ) % static_cast<uint8_t>(item::count));
-            }
-            else if (input::is_pressed(buttons.up)) {
-                // the up button is pressed
-                if (!static_cast<uint8_t>(selection)) {
-                    selection = static_cast<item>(
-                        static_cast<uint8_t>(item::count) - 1
-                    );
-                }
-                else {
+            else {
+                // get how many items the buttons move. Keeps moving 
+                // while a button is held
+                constexpr static uint32_t count = static_cast<uint8_t>(item::count);
+
+                const uint32_t down = down_repeat.update(buttons.down, delta) % count;
+                const uint32_t up = up_repeat.update(buttons.up, delta) % count;
+
+                if (down || up) {
+                    // move the selection and wrap around
                     selection = static_cast<item>(
-                        (static_cast<uint8_t>(selection) - 1
-                    ) % static_cast<uint8_t>(item::count));
+                        (static_cast<uint8_t>(selection) + count + down - up
+                    ) % count);
+
+                    // redraw the menu with the new selection
+                    screen_base::invalidate();
                 }
             }
         }
 
+        virtual klib::time::us next_frame() override {
+            // wake up for the next step while we are repeating
+            return klib::min(up_repeat.next_step(), down_repeat.next_step());
+        }
+
         virtual void draw(FrameBuffer& frame_buffer, const klib::vector2u& offset) override {
             // clear the background black
             frame_buffer.clear(klib::graphics::black);
@@ -7,7 +7,7 @@
 #include "screen.hpp"
 
 namespace menu {
-    template <typename FrameBuffer, typename Storage, typename Rtc, typename Usb>
+    template <typename FrameBuffer, typename Storage, typename Rtc, typename Usb, typename Drift>
     class splash: public screen<FrameBuffer> {
     protected:
         using color = klib::graphics::color;
@@ -91,6 +91,9 @@ namespace menu {
             // init the rtc
             Rtc::init();
 
+            // start estimating the drift of the rtc
+            Drift::init();
+
             // init the storage for all the keys
             Storage::init({}, 
                 reinterpret_cast<uint32_t>(&__profiles_start), 
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <klib/io/rtc.hpp>
+#include <klib/io/systick.hpp>
+
+#include <drift.hpp>
 
 #include "screen.hpp"
 #include "numeric_popup.hpp"
@@ -41,6 +44,12 @@ namespace menu {
         // popup to show items
         numeric_popup<FrameBuffer>& popup;
 
+        // time of the rtc all the popups are filled with and the 
+        // runtime when we took it. Taken once when the year popup
+        // opens so every field shows the same moment
+        klib::time::s prefill = klib::time::s(0);
+        klib::time::ms opened = {};
+        uint8_t prefill_second = 0;
 
         void next(int32_t value) {
             // store the value
@@ -63,12 +72,45 @@ namespace menu {
                 case steps::second:
                     date.second = static_cast<uint8_t>(value);
                     
-                    // we are done. Update the RTC time
-                    Rtc::set(klib::io::rtc::datetime_to_epoch(
-                        date.year, date.month, 
-                        date.day, date.hour, 
-                        date.minute, date.second
-                    ) - klib::time::s(date.timezone * (60 * 60)));
+                    {
+                        // get the time of the rtc before we change it
+                        const auto previous = Rtc::get();
+
+                        auto epoch = klib::io::rtc::datetime_to_epoch(
+                            date.year, date.month, 
+                            date.day, date.hour, 
+                            date.minute, date.second
+                        ) - klib::time::s(date.timezone * (60 * 60));
+
+                        if (epoch.value == prefill.value) {
+                            // the user did not change anything. Keep
+                            // the rtc running. Setting the time we 
+                            // showed moves it back by the time the 
+                            // popup was open
+                        }
+                        else if (date.second == prefill_second) {
+                            // the user did not set the seconds. Add 
+                            // the time since the year popup opened
+                            // to the time we showed. This is not 
+                            // synced to a reference so it is not a
+                            // sample of the drift
+                            epoch = epoch + klib::time::s(static_cast<uint32_t>(
+                                (klib::io::systick<>::get_runtime() - opened).value / 1000
+                            ));
+
+                            Rtc::set(epoch);
+
+                            drift::history<RtcPeriph>::discard();
+                        }
+                        else {
+                            // we are done. Update the RTC time
+                            Rtc::set(epoch);
+
+                            // use the difference as a sample of the 
+                            // drift of the rtc
+                            drift::history<RtcPeriph>::record(previous.value, epoch.value);
+                        }
+                    }
 
                     // go back one screen to the setings menu
                     screen_base::buffer.back();
@@ -101,10 +143,19 @@ namespace menu {
         }
 
         void change_screen(const steps current) {
-            // get the current time with the timezone compensation
+            // take the time we show when the year popup opens. The 
+            // other popups show the same time
+            if (current == steps::year) {
+                prefill = Rtc::get();
+                opened = klib::io::systick<>::get_runtime();
+            }
+
+            // get the time with the timezone compensation
             const auto t = klib::io::rtc::epoch_to_datetime(
-                Rtc::get() + klib::time::s(date.timezone * (60 * 60))
-            );            
+                prefill + klib::time::s(date.timezone * (60 * 60))
+            );
+
+            prefill_second = t.seconds;
 
             // get what state we are in
             switch (current) {
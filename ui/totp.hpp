@@ -1,13 +1,13 @@
 #pragma once
 
+#include <array>
 #include <span>
 
-#include <klib/crypt/totp.hpp>
-#include <klib/crypt/sha1.hpp>
 #include <klib/lookuptable.hpp>
 #include <klib/io/systick.hpp>
 
 #include <storage.hpp>
+#include <hmac.hpp>
 #include <math.hpp>
 
 #include "screen.hpp"
@@ -28,7 +28,7 @@ namespace menu {
     template <typename FrameBuffer, typename Storage, typename Rtc, typename RtcPeriph, typename Usb>
     class totp: public screen<FrameBuffer> {
     protected:
-        using hash = klib::crypt::sha1;
+        using hash = hmac::sha1_totp;
         using screen_base = screen<FrameBuffer>;
 
         klib::time::s last_epoch = {};
@@ -41,7 +41,7 @@ namespace menu {
         char current_token_buf[16] = {};
         char next_token_buf[16] = {};
         char seconds_left_buf[7] = {};
-        char index_buf[6] = {};
+        char index_buf[8] = {};
 
         constexpr static uint32_t step_size = 2;
         using lookuptable = klib::lookuptable<360 / step_size, int8_t>;
@@ -90,51 +90,216 @@ namespace menu {
         uint32_t current = 0;
 
         /**
-         * @brief Get get the token based on the entry and the current time
+         * @brief Cached tokens of a profile for a time step
          * 
+         */
+        struct token_cache {
+            // profile index the tokens belong to
+            uint32_t profile;
+
+            // time step of the current token
+            uint32_t counter;
+
+            // token for the current and the next time step
+            uint32_t current;
+            uint32_t next;
+        };
+
+        // marker for a cache entry that does not have any tokens
+        constexpr static uint32_t invalid_profile = 0xffffffff;
+        constexpr static uint32_t invalid_counter = 0xffffffff;
+
+        // amount of profiles we keep the tokens for
+        constexpr static uint32_t token_slots = 16;
+
+        // amount of profiles before and after the current profile 
+        // the idle job keeps up to date. Always leaves a slot free
+        // to replace
+        constexpr static uint32_t token_window = (token_slots / 2) - 1;
+
+        // tokens of the profiles around the current profile. Kept up
+        // to date in the idle time of the main loop so switching 
+        // profiles does not need to hash anything
+        std::array<token_cache, token_slots> tokens = {};
+
+        // position of the profile index in the rtc register
+        constexpr static uint32_t profile_shift = 5;
+        constexpr static uint32_t profile_mask = 0xff;
+
+        // last step of the timer circle we have drawn
+        uint32_t last_timer_step = 0;
+
+        // auto repeat of the up and down buttons
+        input::repeat up_repeat;
+        input::repeat down_repeat;
+
+        // region with the tokens and the timer circle. Changes
+        // every second
+        constexpr static damage timer_region = {
+            klib::vector2i{0, 48}, klib::vector2i{240, 89}
+        };
+
+        // region with the epoch and the delta at the bottom of 
+        // the screen
+        constexpr static damage footer_region = {
+            klib::vector2i{0, 126}, klib::vector2i{240, 135}
+        };
+
+        /**
+         * @brief Get get the token based on the entry and the time step
+         * 
+         * @param index 
          * @param entry 
-         * @param current 
+         * @param counter 
          * @return uint32_t 
          */
-        uint32_t get_token(const storage::entry entry, const klib::time::s current) {
-            // check the amount of digits we should return
-            switch (entry.digits) {
-                case storage::digit::digits_6:
-                    return klib::crypt::totp<hash, 6>::hash(
-                        reinterpret_cast<const uint8_t*>(entry.key.data()), 
-                        entry.key.size(), current.value, entry.interval, 0
-                    );
-                case storage::digit::digits_8:
-                    return klib::crypt::totp<hash, 8>::hash(
-                        reinterpret_cast<const uint8_t*>(entry.key.data()), 
-                        entry.key.size(), current.value, entry.interval, 0
-                    );  
+        uint32_t get_token(const uint32_t index, const storage::entry& entry, const uint32_t counter) {
+            // for all the other formats return 0
+            if (!storage::is_valid(entry.digits)) {
+                return 0;
             }
 
-            // for all the other formats return 0
-            return 0;
+            // hash using the precomputed midstates of the key. This 
+            // only needs to hash the counter and the inner hash using
+            // the kernel specialized for the totp counter
+            return hmac::totp<hash>(
+                Storage::get_midstate(index), counter, 
+                static_cast<uint8_t>(entry.digits)
+            );
+        }
+
+        /**
+         * @brief Returns if a profile is close enough to the current
+         * profile to keep its tokens
+         * 
+         * @param index 
+         * @return true 
+         * @return false 
+         */
+        bool in_window(const uint32_t index) const {
+            const uint32_t size = Storage::size();
+
+            // get the distance in both directions. The profiles wrap
+            // around when switching
+            const uint32_t forward = (index + size - current) % size;
+            const uint32_t backward = (current + size - index) % size;
+
+            return (forward <= token_window) || (backward <= token_window);
+        }
+
+        /**
+         * @brief Find the cached tokens of a profile. Returns nullptr
+         * when the profile is not in the cache
+         * 
+         * @param index 
+         * @return token_cache* 
+         */
+        token_cache* find_tokens(const uint32_t index) {
+            for (auto& cache: tokens) {
+                if (cache.profile == index) {
+                    return &cache;
+                }
+            }
+
+            return nullptr;
+        }
+
+        /**
+         * @brief Update the cached tokens for the entry at the time 
+         * step. Only hashes the tokens that are not in the cache
+         * 
+         * @param index 
+         * @param entry 
+         * @param counter 
+         * @return const token_cache& 
+         */
+        const token_cache& update_tokens(const uint32_t index, const storage::entry& entry, const uint32_t counter) {
+            token_cache* cache = find_tokens(index);
+
+            // check if we need to replace a slot. Use a slot of a 
+            // profile that is far away from the current profile
+            if (cache == nullptr) {
+                cache = &tokens[index % token_slots];
+
+                for (auto& c: tokens) {
+                    if ((c.profile == invalid_profile) || !in_window(c.profile)) {
+                        cache = &c;
+
+                        break;
+                    }
+                }
+
+                cache->profile = index;
+                cache->counter = invalid_counter;
+            }
+
+            // check if the cache already has the tokens
+            if (cache->counter == counter) {
+                return *cache;
+            }
+
+            // check if we moved to the next time step. The next 
+            // token is now the current token
+            if ((cache->counter != invalid_counter) && (cache->counter + 1 == counter)) {
+                cache->current = cache->next;
+            }
+            else {
+                cache->current = get_token(index, entry, counter);
+            }
+
+            // get the token for the next time step
+            cache->next = get_token(index, entry, counter + 1);
+
+            // update what the cache contains
+            cache->counter = counter;
+
+            return *cache;
+        }
+
+        /**
+         * @brief Get the time we are in the interval of the entry
+         * 
+         * @param entry 
+         * @return klib::time::ms 
+         */
+        klib::time::ms get_timer_runtime(const storage::entry& entry) const {
+            return (
+                (last_runtime - last_epoch_runtime) + static_cast<klib::time::ms>(
+                    klib::time::s(last_epoch.value % entry.interval)
+                )
+            );
         }
 
     public:
         totp():
-            current(((RtcPeriph::port->GPREG4 >> 5) & 0x1f))
+            current(((RtcPeriph::port->GPREG4 >> profile_shift) & profile_mask))
         {}
 
         virtual void activate(const screen_id id) override {
             // check if we need to reset the current index
-            if (current >= Storage::get_entries().size()) {
+            if (current >= Storage::size()) {
                 current = 0;
             }
+
+            // the profiles might have changed. Clear the cache of
+            // all the profiles. The idle job fills it again
+            for (auto& cache: tokens) {
+                cache.profile = invalid_profile;
+            }
+
+            // do not continue a repeat from before we left
+            up_repeat.stop();
+            down_repeat.stop();
         }
 
         virtual void main(const klib::time::us delta, const input::buttons& buttons) override {
             bool totp_changed = false;
 
-            // get all entries
-            const auto& entries = Storage::get_entries();
+            // get the amount of entries
+            const uint32_t entries = Storage::size();
 
             // if we do not have any entries go directly to usb mode
-            if (!entries.size()) {
+            if (!entries) {
                 // change to the settings menu
                 screen_base::buffer.change(screen_id::config);
 
@@ -156,44 +321,36 @@ namespace menu {
                 // change to the settings menu
                 screen_base::buffer.change(screen_id::settings);
             }
-            else if (input::is_pressed(buttons.up)) {                
-                // up button pressed
-                if (!current) {
-                    current = (entries.size() - 1);
-                }
-                else {
-                    current--;
-                }
+            else {
+                // get how many profiles the buttons move. Keeps 
+                // moving while a button is held
+                const uint32_t down = down_repeat.update(buttons.down, delta) % entries;
+                const uint32_t up = up_repeat.update(buttons.up, delta) % entries;
+
+                if (down || up) {
+                    // move to the new profile and wrap around
+                    current = (current + entries + down - up) % entries;
+
+                    // update the rtc register
+                    RtcPeriph::port->GPREG4 = (
+                        (RtcPeriph::port->GPREG4 & ~(profile_mask << profile_shift)) | 
+                        ((current & profile_mask) << profile_shift)
+                    );
 
-                // update the rtc register
-                RtcPeriph::port->GPREG4 = (RtcPeriph::port->GPREG4 & ~(0x1f << 5)) | ((current & 0x1f) << 5);
+                    // mark the totp as changed to force a redraw of
+                    // all the text buffers
+                    totp_changed = true;
 
-                // mark the totp as changed to force a redraw of
-                // all the text buffers
-                totp_changed = true;
-            }
-            else if (input::is_pressed(buttons.down)) {
-                // down button pressed
-                if (current + 1 >= entries.size()) {
-                    current = 0;
-                }
-                else {
-                    current++;
+                    // the profile changed. Redraw everything
+                    screen_base::invalidate();
                 }
-
-                // update the rtc register
-                RtcPeriph::port->GPREG4 = (RtcPeriph::port->GPREG4 & ~(0x1f << 5)) | ((current & 0x1f) << 5);
-
-                // mark the totp as changed to force a redraw of
-                // all the text buffers
-                totp_changed = true;
             }
 
             // get the rtc time
             const auto time = Rtc::get();
 
             // get a reference to the current entry
-            const auto& entry = entries[current];
+            const auto& entry = Storage::get(current);
 
             // check if we should update the hashes
             if ((time != last_epoch) || (last_interval != entry.interval)) {
@@ -208,6 +365,10 @@ namespace menu {
 
                     // update the epoch buffer
                     klib::string::itoa(last_epoch.value, epoch_buf);
+
+                    // update the delta with the epoch. The footer is
+                    // only redrawn when the epoch changes
+                    klib::string::itoa(delta.value, delta_buf);
                 }
 
                 // update the seconds left in this cycle
@@ -220,38 +381,40 @@ namespace menu {
                 // to force a update on the buffers
                 totp_changed = true;
 
+                // mark the tokens, timer and the epoch as changed
+                screen_base::invalidate(timer_region.start, timer_region.end);
+                screen_base::invalidate(footer_region.start, footer_region.end);
+
                 // update the last interval
                 last_interval = entry.interval;
             }
 
             if (totp_changed) {
-                // update the tokens
-                const uint32_t current_token = get_token(entry, last_epoch);
+                // get the tokens from the cache. This only hashes when
+                // the idle job did not get to this profile yet
+                const auto& cache = update_tokens(
+                    current, entry, last_epoch.value / entry.interval
+                );
 
                 // copy the token to the buffer and set the width
                 // based on the amount of digits
-                klib::string::itoa(current_token, current_token_buf);
+                klib::string::itoa(cache.current, current_token_buf);
                 klib::string::set_width(current_token_buf, 
                     static_cast<uint8_t>(entry.digits), '0'
                 );
 
-                // get the next token
-                const uint32_t next_token = get_token(
-                    entry, last_epoch + klib::time::s(entry.interval)
-                );
-
                 // copy the token to the buffer and set the width
                 // based on the amount of digits
-                klib::string::itoa(next_token, next_token_buf);
+                klib::string::itoa(cache.next, next_token_buf);
                 klib::string::set_width(next_token_buf, 
                     static_cast<uint8_t>(entry.digits), '0'
                 );
 
                 // get the width we should use for the index string
-                const uint32_t index_width = klib::string::detail::count_chars(entries.size());
+                const uint32_t index_width = klib::string::detail::count_chars(entries);
 
-                // only display it while we have less than 100 entries
-                if (entries.size() > 1 && index_width <= 2) {
+                // only display it while we have less than 1000 entries
+                if (entries > 1 && index_width <= 3) {
                     // copy the current index to the buffer
                     klib::string::itoa(current + 1, index_buf);
                     klib::string::set_width(index_buf, index_width, ' ');
@@ -259,28 +422,108 @@ namespace menu {
                     klib::string::strcat(index_buf, "\\");
 
                     char *const ptr = index_buf + klib::string::strlen(index_buf);
-                    klib::string::itoa(entries.size(), ptr);
+                    klib::string::itoa(entries, ptr);
                     klib::string::set_width(ptr, index_width, ' ');
                 }
             }
 
-            // get the delta as a string
-            klib::string::itoa(delta.value, delta_buf);
-
             // set the last time we updated
             last_runtime = klib::io::systick<>::get_runtime();
+
+            // get the step the timer circle is at. Only redraw the 
+            // circle when it has moved
+            const uint32_t timer_step = (
+                get_timer_runtime(entry).value * (lookuptable_sin[0].size / entry.interval)
+            ) / 1000;
+
+            if (timer_step != last_timer_step) {
+                last_timer_step = timer_step;
+
+                // mark the timer as changed
+                screen_base::invalidate(timer_region.start, timer_region.end);
+            }
+        }
+
+        virtual bool idle() override {
+            // use the same entries for the whole update
+            const auto& profiles = Storage::pin();
+
+            // get the amount of entries
+            const uint32_t entries = profiles.size();
+
+            // amount of profiles around the current profile we keep
+            // up to date (including the current profile)
+            const uint32_t window = klib::min(entries, (token_window * 2) + 1);
+
+            // update the first profile that has tokens for a 
+            // different time step. We only do a single profile 
+            // at the time to keep the main loop responsive
+            for (uint32_t j = 0; j < window; j++) {
+                // move outwards from the current profile. Alternate
+                // between the next and the previous profiles
+                const uint32_t distance = (j + 1) / 2;
+                const uint32_t i = ((j & 1) ? 
+                    (current + distance) : (current + entries - distance)
+                ) % entries;
+
+                const auto& entry = profiles.get(i);
+                const uint32_t counter = last_epoch.value / entry.interval;
+
+                // skip the profiles that are up to date
+                const token_cache* cache = find_tokens(i);
+
+                if ((cache != nullptr) && (cache->counter == counter)) {
+                    continue;
+                }
+
+                update_tokens(i, entry, counter);
+
+                // we might have more profiles to update
+                return true;
+            }
+
+            // all the profiles are up to date
+            return false;
+        }
+
+        virtual klib::time::us next_frame() override {
+            if (!Storage::size()) {
+                return screen_base::on_input;
+            }
+
+            // get a reference to the current entry
+            const auto& entry = Storage::get(current);
+
+            // amount of steps the timer circle moves every second
+            const uint32_t steps = lookuptable_sin[0].size / entry.interval;
+
+            // get the time the circle moves to the next step
+            const uint32_t runtime = get_timer_runtime(entry).value;
+            const uint32_t next_step = (((last_timer_step + 1) * 1000) + (steps - 1)) / steps;
+
+            // get the time until the rtc changes to the next second. If
+            // we are past it poll until the rtc has changed
+            const uint32_t since_epoch = (last_runtime - last_epoch_runtime).value;
+            const uint32_t next_second = (since_epoch < 1000) ? (1000 - since_epoch) : 10;
+
+            const auto next = static_cast<klib::time::us>(
+                klib::time::ms(klib::min(next_step - runtime, next_second))
+            );
+
+            // wake up earlier for the next step while we are repeating
+            return klib::min(next, klib::min(up_repeat.next_step(), down_repeat.next_step()));
         }
 
         virtual void draw(FrameBuffer& frame_buffer, const klib::vector2u& offset) override {
-            // get all entries
-            const auto& entries = Storage::get_entries();
+            // use the same entries for the whole draw
+            const auto& profiles = Storage::pin();
 
-            if (!entries.size()) {
+            if (current >= profiles.size()) {
                 return;
             }
 
             // get a reference to the current entry
-            const auto& entry = entries[current];
+            const auto& entry = profiles.get(current);
 
             // clear the background
             frame_buffer.clear(klib::graphics::black);
@@ -359,11 +602,7 @@ namespace menu {
                 204, 68
             } - offset.cast<int32_t>();
 
-            const klib::time::ms runtime = (
-                (last_runtime - last_epoch_runtime) + static_cast<klib::time::ms>(
-                    klib::time::s(last_epoch.value % entry.interval)
-                )
-            );
+            const klib::time::ms runtime = get_timer_runtime(entry);
 
             // draw all the circles
             for (uint32_t i = 0; i < sizeof(lookuptable_sin) / sizeof(lookuptable_sin[0]); i++) {
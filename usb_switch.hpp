@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+
+#include <klib/units.hpp>
+#include <klib/io/systick.hpp>
+
+namespace usb {
+    /**
+     * @brief Switches the usb peripheral between two devices
+     * without blocking. The old device is disconnected directly,
+     * the new device is initialized from the main loop after the
+     * host had time to detect the disconnect
+     * 
+     */
+    class switcher {
+    protected:
+        // time the host needs to detect the disconnect (500 ms)
+        constexpr static klib::time::us settle_time = 500'000;
+
+        // init function of the device we switch to. nullptr when
+        // we are not switching
+        static inline void (*pending)() = nullptr;
+
+        // time we disconnected the old device
+        static inline klib::time::us start = {};
+
+    public:
+        /**
+         * @brief Start switching from one device to a other device
+         * 
+         * @tparam From 
+         * @tparam To 
+         */
+        template <typename From, typename To>
+        static void begin() {
+            // when we are still switching the old device is already
+            // disconnected. Only change the device we switch to
+            if (pending == nullptr) {
+                // disconnect the old device from the host. This
+                // prevents a blue screen when we suddenly change
+                // to a different usb type
+                From::disconnect();
+
+                start = klib::io::systick<>::template get_runtime<klib::time::us>();
+            }
+
+            pending = To::init;
+        }
+
+        /**
+         * @brief Connect the new device when the host had enough
+         * time. Should be called from the main loop
+         * 
+         * @return true when the new device is connected by this call 
+         * @return false 
+         */
+        static bool update() {
+            if ((pending == nullptr) || (remaining().value > 0)) {
+                return false;
+            }
+
+            // initialize the new device
+            const auto init = pending;
+            pending = nullptr;
+
+            init();
+
+            return true;
+        }
+
+        /**
+         * @brief Returns if we are switching devices
+         * 
+         * @return true 
+         * @return false 
+         */
+        static bool busy() {
+            return pending != nullptr;
+        }
+
+        /**
+         * @brief Returns the time until the new device is connected
+         * 
+         * @return klib::time::us 
+         */
+        static klib::time::us remaining() {
+            if (pending == nullptr) {
+                return {};
+            }
+
+            const auto elapsed = klib::io::systick<>::template get_runtime<klib::time::us>() - start;
+
+            return (elapsed >= settle_time) ? klib::time::us{} : (settle_time - elapsed);
+        }
+    };
+}